@@ -12,6 +12,11 @@ void* calloc(size_t count, size_t size)
 	return sys_calloc(count, size);
 }
 extern "C"
+void* realloc(void* ptr, size_t size)
+{
+	return sys_realloc(ptr, size);
+}
+extern "C"
 void free(void* ptr)
 {
 	return sys_free(ptr);
@@ -3,9 +3,33 @@
 #include <stdint.h>
 void* _impure_ptr;
 
+// memory and string functions done by the emulator, on host memory
+#define SYSCALL_MEMCPY   5
+#define SYSCALL_MEMSET   6
+#define SYSCALL_MEMMOVE  7
+#define SYSCALL_MEMCMP   8
+#define SYSCALL_STRLEN  10
+#define SYSCALL_STRCMP  11
+// below this many bytes, a loop is cheaper than a system call
+#define NATIVE_THRESHOLD 64
+
+static inline long native_call(long n, long arg0, long arg1, long arg2)
+{
+	register long a0 asm("a0") = arg0;
+	register long a1 asm("a1") = arg1;
+	register long a2 asm("a2") = arg2;
+	register long syscall_id asm("a7") = n;
+
+	asm volatile ("scall" : "+r"(a0) : "r"(a1), "r"(a2), "r"(syscall_id) : "memory");
+
+	return a0;
+}
+
 __attribute__((used))
 void* memset(char* dest, int ch, size_t size)
 {
+	if (size >= NATIVE_THRESHOLD)
+		return (void*) native_call(SYSCALL_MEMSET, (long) dest, ch, size);
 	for (size_t i = 0; i < size; i++)
 		dest[i] = ch;
 	return dest;
@@ -13,12 +37,16 @@ void* memset(char* dest, int ch, size_t size)
 __attribute__((used))
 void* memcpy(char* dest, const char* src, size_t size)
 {
+	if (size >= NATIVE_THRESHOLD)
+		return (void*) native_call(SYSCALL_MEMCPY, (long) dest, (long) src, size);
 	for (size_t i = 0; i < size; i++)
 		dest[i] = src[i];
 	return dest;
 }
 void* memmove(char* dest, const char* src, size_t size)
 {
+	if (size >= NATIVE_THRESHOLD)
+		return (void*) native_call(SYSCALL_MEMMOVE, (long) dest, (long) src, size);
 	if (dest <= src)
 	{
 		for (size_t i = 0; i < size; i++)
@@ -33,6 +61,8 @@ void* memmove(char* dest, const char* src, size_t size)
 }
 int memcmp(const void* ptr1, const void* ptr2, size_t n)
 {
+	if (n >= NATIVE_THRESHOLD)
+		return native_call(SYSCALL_MEMCMP, (long) ptr1, (long) ptr2, n);
 	const uint8_t* iter1 = (const uint8_t*) ptr1;
 	const uint8_t* iter2 = (const uint8_t*) ptr2;
 	while (n > 0 && *iter1 == *iter2) {
@@ -51,17 +81,11 @@ char* strcpy(char* dst, const char* src)
 }
 size_t strlen(const char* str)
 {
-	const char* iter;
-	for (iter = str; *iter; ++iter);
-	return iter - str;
+	return native_call(SYSCALL_STRLEN, (long) str, 0, 0);
 }
 int strcmp(const char* str1, const char* str2)
 {
-	while (*str1 != 0 && *str2 != 0  && *str1 == *str2) {
-      str1++;
-      str2++;
-   }
-   return *str1 - *str2;
+	return native_call(SYSCALL_STRCMP, (long) str1, (long) str2, 0);
 }
 char* strcat(char* dest, const char* src)
 {
@@ -0,0 +1,68 @@
+#include "syscall_ring.hpp"
+
+namespace sysring
+{
+static const unsigned long RING_ENTRIES = 64;
+
+static Header     header;
+static Submission sq[RING_ENTRIES];
+static Completion cq[RING_ENTRIES];
+
+// make sure the emulator sees our stores, and we see its stores
+static inline void barrier() {
+	asm volatile("" : : : "memory");
+}
+
+long init()
+{
+	header.entries = RING_ENTRIES;
+	header.sq_addr = (unsigned long) &sq[0];
+	header.cq_addr = (unsigned long) &cq[0];
+	barrier();
+	return syscall(SYSCALL_RING_SETUP, (long) &header);
+}
+
+unsigned long pending()
+{
+	return header.sq_tail - header.sq_head;
+}
+
+long flush()
+{
+	barrier();
+	const long res = syscall(SYSCALL_RING_ENTER, 0);
+	barrier();
+	return res;
+}
+
+void submit(unsigned long user_data, long sysno,
+			long a0, long a1, long a2, long a3, long a4, long a5)
+{
+	// the ring is full: make room for the completions, dropping
+	// any that were not picked up, and then drain it
+	if (pending() == RING_ENTRIES) {
+		header.cq_head = header.cq_tail;
+		flush();
+	}
+	auto& sqe = sq[header.sq_tail & (RING_ENTRIES-1)];
+	sqe.sysno = sysno;
+	sqe.user_data = user_data;
+	sqe.args[0] = a0;
+	sqe.args[1] = a1;
+	sqe.args[2] = a2;
+	sqe.args[3] = a3;
+	sqe.args[4] = a4;
+	sqe.args[5] = a5;
+	barrier();
+	header.sq_tail++;
+}
+
+bool complete(Completion& result)
+{
+	barrier();
+	if (header.cq_head == header.cq_tail) return false;
+	result = cq[header.cq_head & (RING_ENTRIES-1)];
+	header.cq_head++;
+	return true;
+}
+}
@@ -0,0 +1,64 @@
+#pragma once
+#include "include/syscall.hpp"
+#include <cstddef>
+
+/***
+ * Example usage:
+ *
+ *  sysring::init();
+ *  for (int i = 0; i < 10; i++)
+ *      sysring::submit(i, SYSCALL_WRITE, 0, (long) "Hello\n", 6);
+ *  sysring::flush();
+ *
+ *  sysring::Completion c;
+ *  while (sysring::complete(c))
+ *      printf("Request %lu returned %ld\n", c.user_data, (long) c.result);
+ *
+ *  Many system calls can be made with a single trap into the emulator.
+ *  Note: only system calls that do not switch threads can be submitted.
+***/
+
+#define SYSCALL_RING_SETUP 502
+#define SYSCALL_RING_ENTER 503
+
+namespace sysring
+{
+/* The layout shared with the emulator (see libriscv/syscall_ring.hpp) */
+struct Header {
+	unsigned long sq_head;
+	unsigned long sq_tail;
+	unsigned long cq_head;
+	unsigned long cq_tail;
+	unsigned long entries;
+	unsigned long sq_addr;
+	unsigned long cq_addr;
+};
+struct Submission {
+	unsigned long sysno;
+	unsigned long user_data;
+	long args[6];
+};
+struct Completion {
+	unsigned long user_data;
+	long result;
+};
+
+/* Register the ring with the emulator. Returns 0 on success. */
+long init();
+
+/* Queue a system call, flushing the ring first if it is full.
+   @user_data is given back in the completion. */
+void submit(unsigned long user_data, long sysno,
+			long a0 = 0, long a1 = 0, long a2 = 0,
+			long a3 = 0, long a4 = 0, long a5 = 0);
+
+/* Have the emulator handle every queued system call.
+   Returns the number of new completions. */
+long flush();
+
+/* Pop the oldest completion into @result. Returns false if there are none. */
+bool complete(Completion& result);
+
+/* Number of queued, not yet handled system calls */
+unsigned long pending();
+}
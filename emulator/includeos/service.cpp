@@ -23,6 +23,19 @@ static const std::vector<std::string> args = {
 #include <threads.hpp>
 static uint64_t micros_now();
 
+// built once, shared by every machine
+static const riscv::SyscallTable<4>& linux_syscalls()
+{
+	static const riscv::SyscallTable<4> table = [] {
+		riscv::SyscallTable<4> table;
+		setup_linux_syscalls(table);
+		setup_multithreading(table);
+		table.freeze();
+		return table;
+	}();
+	return table;
+}
+
 static void multiprocess_task(buffer_t binary)
 {
 	SMP::global_lock();
@@ -36,8 +49,8 @@ static void multiprocess_task(buffer_t binary)
 	riscv::Machine<riscv::RISCV32> machine { binary, MAX_MEMORY };
 
 	prepare_linux<riscv::RISCV32>(machine, args, env);
-	setup_linux_syscalls(state, machine);
-	setup_multithreading(state, machine);
+	machine.attach_syscall_table(&linux_syscalls());
+	attach_multithreading(state, machine);
 
 	try {
 		machine.simulate(MAX_INSTRUCTIONS);
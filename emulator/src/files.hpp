@@ -0,0 +1,112 @@
+#pragma once
+#include <cerrno>
+#include <fcntl.h>
+#include <stdexcept>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+// The files a guest can open: regular files under one host directory,
+// read-only. Guest paths are resolved one component at a time below the
+// directory, refusing symlinks and "..", so that nothing outside of it
+// can be reached. Guest file descriptors start at 3, and are indices
+// into a table of host file descriptors.
+struct FileTable
+{
+	static constexpr int FIRST_FD = 3;
+	static constexpr int MAX_FILES = 64;
+
+	// Opens @path for reading, giving a guest fd or a negative errno
+	int open(const std::string& path, int flags);
+	int close(int fd);
+	// The host fd behind a guest fd, or -1
+	int host_fd(int fd) const noexcept {
+		const size_t idx = fd - FIRST_FD;
+		return (fd >= FIRST_FD && idx < m_fds.size()) ? m_fds[idx] : -1;
+	}
+
+	FileTable(const std::string& directory);
+	FileTable(const FileTable&) = delete;
+	FileTable& operator= (const FileTable&) = delete;
+	~FileTable();
+
+private:
+	int m_root = -1;
+	std::vector<int> m_fds; // -1 when closed
+};
+
+inline FileTable::FileTable(const std::string& directory)
+{
+	m_root = ::open(directory.c_str(), O_PATH | O_DIRECTORY | O_CLOEXEC);
+	if (m_root < 0)
+		throw std::runtime_error("Could not open sandbox directory: " + directory);
+}
+inline FileTable::~FileTable()
+{
+	for (int fd : m_fds)
+		if (fd >= 0) ::close(fd);
+	::close(m_root);
+}
+
+inline int FileTable::open(const std::string& path, int flags)
+{
+	// only reading is allowed
+	if ((flags & O_ACCMODE) != O_RDONLY || (flags & (O_CREAT | O_TRUNC)))
+		return -EACCES;
+	// absolute paths start at the sandbox directory too
+	std::vector<std::string> parts;
+	size_t start = 0;
+	while (start <= path.size())
+	{
+		size_t end = path.find('/', start);
+		if (end == std::string::npos) end = path.size();
+		const std::string part = path.substr(start, end - start);
+		if (part == "..") return -EACCES;
+		if (!part.empty() && part != ".") parts.push_back(part);
+		start = end + 1;
+	}
+	if (parts.empty()) return -EISDIR;
+
+	int dir = m_root;
+	for (size_t i = 0; i + 1 < parts.size(); i++) {
+		const int next = ::openat(dir, parts[i].c_str(),
+			O_PATH | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+		if (dir != m_root) ::close(dir);
+		if (next < 0) return -errno;
+		dir = next;
+	}
+	const int fd = ::openat(dir, parts.back().c_str(),
+		O_RDONLY | O_NOFOLLOW | O_CLOEXEC | O_NONBLOCK);
+	const int error = errno;
+	if (dir != m_root) ::close(dir);
+	if (fd < 0) return (error == ELOOP) ? -EACCES : -error;
+
+	struct stat st;
+	if (::fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+		::close(fd);
+		return -EACCES;
+	}
+	// reuse the lowest closed slot
+	for (size_t i = 0; i < m_fds.size(); i++) {
+		if (m_fds[i] < 0) {
+			m_fds[i] = fd;
+			return FIRST_FD + i;
+		}
+	}
+	if (m_fds.size() >= MAX_FILES) {
+		::close(fd);
+		return -EMFILE;
+	}
+	m_fds.push_back(fd);
+	return FIRST_FD + m_fds.size() - 1;
+}
+
+inline int FileTable::close(int fd)
+{
+	const int hfd = host_fd(fd);
+	if (hfd < 0) return -EBADF;
+	::close(hfd);
+	m_fds[fd - FIRST_FD] = -1;
+	return 0;
+}
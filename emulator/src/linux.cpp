@@ -118,7 +118,7 @@ void prepare_linux(riscv::Machine<4>& machine,
 	// re-initialize machine stack-pointer
 	machine.cpu.reg(RISCV::REG_SP) = dst;
 
-	if (riscv::verbose_machine) {
+	if (machine.verbose_machine) {
 		printf("* SP = 0x%X  Argument list: %zu bytes\n", dst, argsize);
 		printf("* Program end: 0x%X\n", machine.memory.elf_end_vaddr());
 	}
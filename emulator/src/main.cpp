@@ -5,6 +5,7 @@ static inline std::vector<uint8_t> load_file(const std::string&);
 static constexpr uint64_t MAX_MEMORY = 1024 * 1024 * 24;
 static constexpr bool full_linux_guest = false;
 static constexpr bool newlib_mini_guest = false;
+static constexpr bool parallel_guest_threads = false;
 #include "linux.hpp"
 #include "syscalls.hpp"
 #include "threads.hpp"
@@ -23,7 +24,6 @@ int main(int argc, const char** argv)
 		"hello_world", "test!"
 	};
 
-	riscv::verbose_machine = false;
 	riscv::Machine<riscv::RISCV32> machine { binary, MAX_MEMORY };
 
 	// somewhere to store the guest outputs and exit status
@@ -37,8 +37,14 @@ int main(int argc, const char** argv)
 		prepare_linux<riscv::RISCV32>(machine, args, env);
 		// some extra syscalls
 		setup_linux_syscalls(state, machine);
+		// the guest can read the files in this directory, if given
+		if (const char* directory = getenv("REMU_FILES"))
+			setup_sandboxed_files(state, machine, directory);
 		// multi-threading
-		setup_multithreading(state, machine);
+		if constexpr (parallel_guest_threads)
+			setup_parallel_threads(state, machine);
+		else
+			setup_multithreading(state, machine);
 	}
 	else if constexpr (newlib_mini_guest)
 	{
@@ -50,6 +56,7 @@ int main(int argc, const char** argv)
 		machine.setup_argv(args);
 		setup_minimal_syscalls(state, machine);
 		setup_native_heap_syscalls(state, machine, 6*1024*1024);
+		setup_native_memory_syscalls(machine);
 		setup_native_threads(state, machine);
 	}
 
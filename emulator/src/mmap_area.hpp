@@ -0,0 +1,80 @@
+#pragma once
+#include <cstdint>
+#include <iterator>
+#include <map>
+
+// The guest address space that mmap() hands out, in whole pages.
+// Unmapped ranges are merged with their free neighbours, and reused
+// from the bottom up.
+struct MmapArea
+{
+	static constexpr uint32_t PAGE_SIZE = 4096;
+
+	// Take @len bytes from the lowest free range that fits, or 0
+	uint32_t allocate(uint32_t len);
+	// Take exactly [addr, addr+len), if all of it is free
+	bool     allocate_at(uint32_t addr, uint32_t len);
+	// Give back [addr, addr+len), the parts that are already free too
+	void     release(uint32_t addr, uint32_t len);
+
+	bool contains(uint32_t addr, uint32_t len) const noexcept {
+		return addr >= m_begin && addr <= m_end && len <= m_end - addr;
+	}
+	static uint32_t page_align(uint32_t len) noexcept {
+		return (len + (PAGE_SIZE-1)) & ~(PAGE_SIZE-1);
+	}
+
+	MmapArea(uint32_t begin, uint32_t end)
+		: m_begin(begin), m_end(end), m_free {{begin, end - begin}} {}
+
+private:
+	uint32_t m_begin;
+	uint32_t m_end;
+	std::map<uint32_t, uint32_t> m_free; // address -> length
+};
+
+inline uint32_t MmapArea::allocate(uint32_t len)
+{
+	for (auto it = m_free.begin(); it != m_free.end(); ++it)
+	{
+		if (it->second >= len) {
+			const uint32_t addr = it->first;
+			this->allocate_at(addr, len);
+			return addr;
+		}
+	}
+	return 0;
+}
+
+inline bool MmapArea::allocate_at(uint32_t addr, uint32_t len)
+{
+	// the free range that starts at or before addr
+	auto it = m_free.upper_bound(addr);
+	if (it == m_free.begin()) return false;
+	--it;
+	const uint32_t start = it->first;
+	const uint32_t end = start + it->second;
+	if (addr + len > end || addr + len < addr) return false;
+	m_free.erase(it);
+	if (start < addr) m_free.emplace(start, addr - start);
+	if (addr + len < end) m_free.emplace(addr + len, end - (addr + len));
+	return true;
+}
+
+inline void MmapArea::release(uint32_t addr, uint32_t len)
+{
+	uint32_t end = addr + len;
+	// swallow every free range that overlaps or touches us
+	auto it = m_free.upper_bound(addr);
+	if (it != m_free.begin()) {
+		auto prev = std::prev(it);
+		if (prev->first + prev->second >= addr) it = prev;
+	}
+	while (it != m_free.end() && it->first <= end)
+	{
+		if (it->first < addr) addr = it->first;
+		if (it->first + it->second > end) end = it->first + it->second;
+		it = m_free.erase(it);
+	}
+	m_free.emplace(addr, end - addr);
+}
@@ -3,196 +3,234 @@
 // by fwsGonzo, based on original allocator written in C by Snaipe
 //
 #pragma once
-#include <unistd.h>
-#include <errno.h>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <map>
+#include <set>
+#include <unordered_map>
+#include <vector>
 
 namespace sas_alloc
 {
-struct Chunk
+// Manages a range of guest memory from the host. Small allocations are
+// taken from runs of equally sized blocks, with a free list for each size
+// class. Larger allocations are found by best fit among the free ranges,
+// which are merged with their neighbours when freed. Nothing is stored in
+// guest memory: the size of every allocation is kept in a table keyed by
+// guest address, so that freeing is a single lookup.
+//
+// Larger allocations and runs are whole pages. Every page of a large
+// allocation that is given back is passed to the release callback,
+// so that the host can drop it, and the next owner sees zeroes.
+struct Arena
 {
 	using PointerType = uint32_t;
+	using release_t   = std::function<void(PointerType, size_t)>;
+	static constexpr size_t PAGE_SIZE  = 4096;
+	static constexpr size_t MAX_SMALL  = 4096;
+	static constexpr size_t RUN_SIZE   = 16384;
+	static constexpr size_t NUM_CLASSES = 36;
 
-    Chunk* next = nullptr;
-	Chunk* prev = nullptr;
-    size_t size = 0;
-    bool   free = false;
-    PointerType data = 0;
-
-	Chunk* find(PointerType ptr);
-	Chunk* find_free(size_t size);
-	void   merge_next();
-	void   split_next(size_t size);
-};
-
-struct Arena
-{
-	using PointerType = Chunk::PointerType;
-	Arena() : arena_base(0), arena_current(0), arena_end(0) {}
-	Arena(PointerType base, PointerType end);
-	~Arena();
+	Arena(PointerType base, PointerType end, release_t release = nullptr);
+	Arena(const Arena&) = delete;
+	Arena& operator= (const Arena&) = delete;
 
 	PointerType malloc(size_t size);
 	signed int  free(PointerType);
-
-	inline Chunk& base_chunk() {
-		static Chunk bc;
-	    return bc;
+	// Grow or shrink the allocation at @ptr without moving it, which
+	// succeeds when it stays in its size class, or when a larger
+	// allocation is followed by enough free space.
+	bool        resize(PointerType ptr, size_t size);
+
+	// Usable size of the allocation at @ptr, or 0 if there is none
+	size_t size(PointerType ptr) const;
+	// Number of live allocations
+	size_t allocations() const noexcept { return m_allocs.size(); }
+	// True when the memory of a new allocation of @size is all zeroes
+	bool   zeroed(size_t size) const noexcept {
+		return size > MAX_SMALL && m_release != nullptr;
 	}
 
-	size_t      total_chunks = 0;
+	// 8-byte steps up to 128 bytes, then four classes per doubling
+	static unsigned size_class(size_t size);
+	static size_t   class_size(unsigned cl);
 
 private:
-	PointerType increment(size_t size);
-	void        decrement(size_t size);
-	inline size_t word_align(size_t size) {
-	    return (size + (sizeof(size_t) - 1)) & ~(sizeof(size_t) - 1);
+	struct SizeClass {
+		PointerType run_next = 0; // unused part of the newest run
+		PointerType run_end  = 0;
+		std::vector<PointerType> free;
+	};
+	PointerType alloc_range(size_t length);
+	void        free_range(PointerType addr, size_t length);
+	void        insert_free(PointerType addr, size_t length);
+	void        erase_free(std::map<PointerType, size_t>::iterator);
+	static size_t page_align(size_t size) {
+		return (size + (PAGE_SIZE - 1)) & ~(PAGE_SIZE - 1);
 	}
 
-	PointerType arena_base;
-	PointerType arena_current;
-	PointerType arena_end;
-	Chunk*      last_chunk = nullptr;
+	const PointerType arena_base;
+	const PointerType arena_end;
+	const release_t   m_release;
+	std::unordered_map<PointerType, PointerType> m_allocs; // address -> size
+	SizeClass m_classes[NUM_CLASSES];
+	// free ranges by address, and by size for best fit
+	std::map<PointerType, size_t> m_free;
+	std::set<std::pair<size_t, PointerType>> m_free_by_size;
 };
 
-// find exact free chunk that matches ptr
-inline Chunk* Chunk::find(PointerType ptr)
+inline unsigned Arena::size_class(size_t size)
 {
-    Chunk* ch = this;
-    while (ch != nullptr && !ch->free) {
-		if (ch->data == ptr) return ch;
-		ch = ch->next;
-	}
-    return nullptr;
+	if (size <= 128) return (size + 7) / 8 - 1;
+	const unsigned log = 31 - __builtin_clz(size - 1);
+	return 16 + (log - 7) * 4 + ((size - 1) >> (log - 2)) - 4;
 }
-// find free chunk that has at least given size
-inline Chunk* Chunk::find_free(size_t size)
+inline size_t Arena::class_size(unsigned cl)
 {
-    Chunk* ch = this;
-	while (ch != nullptr && ch->free) {
-		if (ch->size >= size) return ch;
-		ch = ch->next;
-	}
-    return nullptr;
-}
-// merge this and next into this chunk
-inline void Chunk::merge_next()
-{
-	auto* freech = this->next;
-    this->size += freech->size;
-    this->next = freech->next;
-    if (this->next) {
-        this->next->prev = this;
-    }
-	delete freech;
-}
-
-inline void Chunk::split_next(size_t size)
-{
-	Chunk* newch = new Chunk({
-		.next = this->next,
-		.prev = this,
-		.size = this->size - size,
-		.free = true,
-		.data = this->data + (PointerType) size
-	});
-    if (this->next) {
-        this->next->prev = newch;
-    }
-    this->next = newch;
-    this->size = size;
+	if (cl < 16) return (cl + 1) * 8;
+	const unsigned log = 7 + (cl - 16) / 4;
+	return (4 + (cl - 16) % 4 + 1) << (log - 2);
 }
 
 inline Arena::PointerType Arena::malloc(size_t size)
 {
-    if (!size) return 0;
-    size_t length = word_align(size);
-    Chunk* ch = base_chunk().find_free(size);
-    if (ch == nullptr)
+	if (size == 0) return 0;
+	if (size <= MAX_SMALL)
 	{
-		Chunk::PointerType data = this->increment(length);
-		if (data == 0) return 0;
-
-        Chunk* newch = new Chunk({
-			.next = nullptr,
-			.prev = this->last_chunk,
-			.size = length,
-			.free = false,
-			.data = data
-		});
-        this->last_chunk->next = newch;
-		this->last_chunk = newch;
-		this->total_chunks++;
-		return newch->data;
-    } else if (length < ch->size) {
-        ch->split_next(length);
-		this->total_chunks++;
-    }
-    ch->free = false;
-    return ch->data;
+		const unsigned cl = size_class(size);
+		auto& sc = m_classes[cl];
+		const size_t bsize = class_size(cl);
+		PointerType data;
+		if (!sc.free.empty()) {
+			data = sc.free.back();
+			sc.free.pop_back();
+		} else {
+			if (sc.run_end - sc.run_next < bsize) {
+				const PointerType run = alloc_range(RUN_SIZE);
+				if (run == 0) return 0;
+				sc.run_next = run;
+				sc.run_end  = run + RUN_SIZE;
+			}
+			data = sc.run_next;
+			sc.run_next += bsize;
+		}
+		m_allocs.emplace(data, bsize);
+		return data;
+	}
+	const size_t length = page_align(size);
+	if (length < size) return 0;
+	const PointerType data = alloc_range(length);
+	if (data != 0) m_allocs.emplace(data, length);
+	return data;
 }
 
 inline int Arena::free(PointerType ptr)
 {
-    if (ptr == 0 || ptr < arena_base || ptr >= arena_end)
-		return -1;
-
-    Chunk* ch = base_chunk().find(ptr);
-    if (ch == nullptr || ch->data != ptr)
+	auto it = m_allocs.find(ptr);
+	if (it == m_allocs.end())
 		return -1;
 
-    ch->free = true;
-	// merge chunks ahead and behind us
-    if (ch->next && ch->next->free) {
-		if (ch->next == last_chunk) last_chunk = ch;
-        ch->merge_next();
-		this->total_chunks --;
-    }
-    if (ch->prev->free) {
-		ch = ch->prev;
-		if (ch->next == last_chunk) last_chunk = ch;
-        ch->merge_next();
-		this->total_chunks --;
-    }
-	// if we are the last chunk, give back memory
-    if (!ch->next) {
-        ch->prev->next = nullptr;
-		this->decrement(ch->size);
-		delete ch;
-		this->total_chunks --;
-    }
+	const size_t length = it->second;
+	m_allocs.erase(it);
+	if (length <= MAX_SMALL) {
+		m_classes[size_class(length)].free.push_back(ptr);
+	} else {
+		free_range(ptr, length);
+	}
 	return 0;
 }
 
-inline Arena::PointerType Arena::increment(size_t size)
+inline bool Arena::resize(PointerType ptr, size_t size)
 {
-	if (arena_end - arena_current >= size) {
-		PointerType ptr = arena_current;
-		arena_current += size;
-		return ptr;
+	auto it = m_allocs.find(ptr);
+	if (it == m_allocs.end() || size == 0)
+		return false;
+
+	const size_t current = it->second;
+	if (current <= MAX_SMALL || size <= MAX_SMALL) {
+		// small allocations can only stay in their class
+		return size <= MAX_SMALL && current <= MAX_SMALL
+			&& size_class(size) == size_class(current);
 	}
-	return 0;
+	const size_t length = page_align(size);
+	if (length < size) return false;
+	if (length < current) {
+		free_range(ptr + length, current - length);
+	}
+	else if (length > current) {
+		auto next = m_free.find(ptr + current);
+		if (next == m_free.end() || current + next->second < length)
+			return false;
+		const size_t remaining = current + next->second - length;
+		erase_free(next);
+		if (remaining > 0) insert_free(ptr + length, remaining);
+	}
+	it->second = length;
+	return true;
 }
-inline void Arena::decrement(size_t size)
+
+inline size_t Arena::size(PointerType ptr) const
 {
-	arena_current -= size;
-	assert(arena_current >= arena_base);
+	auto it = m_allocs.find(ptr);
+	return (it != m_allocs.end()) ? it->second : 0;
 }
 
-inline Arena::Arena(PointerType base, PointerType end)
-	: arena_base(base), arena_current(base), arena_end(end)
+inline Arena::PointerType Arena::alloc_range(size_t length)
 {
-	this->last_chunk = &base_chunk();
+	auto fit = m_free_by_size.lower_bound({length, 0});
+	if (fit == m_free_by_size.end()) return 0;
+	const size_t range = fit->first;
+	const PointerType addr = fit->second;
+	erase_free(m_free.find(addr));
+	if (range > length) {
+		insert_free(addr + length, range - length);
+	}
+	return addr;
 }
-inline Arena::~Arena()
+
+inline void Arena::free_range(PointerType addr, size_t length)
 {
-	Chunk* ch = base_chunk().next;
-	while (ch != nullptr) {
-		auto* next = ch->next;
-		delete ch;
-		ch = next;
-		this->total_chunks --;
+	if (m_release) m_release(addr, length);
+	// merge with the free range behind us
+	auto next = m_free.lower_bound(addr);
+	if (next != m_free.begin()) {
+		auto prev = std::prev(next);
+		if (prev->first + prev->second == addr) {
+			addr = prev->first;
+			length += prev->second;
+			erase_free(prev);
+		}
+	}
+	// and with the one ahead of us
+	if (next != m_free.end() && addr + length == next->first) {
+		length += next->second;
+		erase_free(next);
 	}
-	assert(total_chunks == 0);
+	insert_free(addr, length);
+}
+
+inline void Arena::insert_free(PointerType addr, size_t length)
+{
+	m_free.emplace(addr, length);
+	m_free_by_size.emplace(length, addr);
+}
+inline void Arena::erase_free(std::map<PointerType, size_t>::iterator it)
+{
+	m_free_by_size.erase({it->second, it->first});
+	m_free.erase(it);
+}
+
+inline Arena::Arena(PointerType base, PointerType end, release_t release)
+	: arena_base(base), arena_end(end), m_release(std::move(release))
+{
+	assert(base != 0 && base < end);
+	assert(base % PAGE_SIZE == 0 && end % PAGE_SIZE == 0);
+	assert(size_class(MAX_SMALL) == NUM_CLASSES-1);
+	this->insert_free(arena_base, arena_end - arena_base);
+	if (m_release) m_release(arena_base, arena_end - arena_base);
 }
 
-} // namespace foreign_heap
+} // namespace sas_alloc
@@ -2,18 +2,23 @@
 #include "native_heap.hpp"
 using namespace riscv;
 static const uint64_t ARENA_BASE = 0x40000000;
-static sas_alloc::Arena arena;
 
 static const uint32_t SYSCALL_MALLOC  = 1;
 static const uint32_t SYSCALL_CALLOC  = 2;
-//static const uint32_t SYSCALL_REALLOC = 3;
+static const uint32_t SYSCALL_REALLOC = 3;
 static const uint32_t SYSCALL_FREE    = 4;
+static const uint32_t SYSCALL_MEMCPY  = 5;
+static const uint32_t SYSCALL_MEMSET  = 6;
+static const uint32_t SYSCALL_MEMMOVE = 7;
+static const uint32_t SYSCALL_MEMCMP  = 8;
+static const uint32_t SYSCALL_STRLEN  = 10;
+static const uint32_t SYSCALL_STRCMP  = 11;
 
 template <int W>
 static long syscall_malloc(Machine<W>& machine)
 {
 	const size_t len = machine.template sysarg<address_type<W>>(0);
-	auto data = arena.malloc(len);
+	auto data = state_of(machine).arena->malloc(len);
 	SYSPRINT("SYSCALL malloc(%zu) = 0x%X\n", len, data);
 	return data;
 }
@@ -23,32 +28,293 @@ static long syscall_calloc(Machine<W>& machine)
 	const size_t count = machine.template sysarg<address_type<W>>(0);
 	const size_t size  = machine.template sysarg<address_type<W>>(1);
 	const size_t len = count * size;
-	auto data = arena.malloc(len);
+	auto* arena = state_of(machine).arena;
+	auto data = arena->malloc(len);
 	SYSPRINT("SYSCALL calloc(%zu, %zu) = 0x%X\n", count, size, data);
-	if (data != 0) {
-		// TODO: optimize this (CoW), **can throw**
+	// large allocations are released pages, which read as zeroes
+	// until they are written to, so only small ones are cleared
+	if (data != 0 && !arena->zeroed(len)) {
 		machine.memory.memset(data, 0, len);
 	}
 	return data;
 }
+// copy @len bytes between two heap allocations on the host, moving
+// the whole pages when both are at the same offset into their pages
+template <int W>
+static void move_data(Machine<W>& machine,
+	address_type<W> dst, address_type<W> src, size_t len)
+{
+	auto& memory = machine.memory;
+	const size_t pmask = Page::size()-1;
+	while (len != 0)
+	{
+		if ((src & pmask) == 0 && (dst & pmask) == 0 && len >= Page::size()) {
+			const size_t pages = len & ~pmask;
+			memory.move_pages(dst, src, pages);
+			dst += pages;
+			src += pages;
+			len -= pages;
+			continue;
+		}
+		const size_t offset = src & pmask;
+		const size_t size = std::min(Page::size() - offset, len);
+		const auto& page = memory.get_page(src);
+		memory.memcpy(dst, page.data() + offset, size);
+		dst += size;
+		src += size;
+		len -= size;
+	}
+}
+template <int W>
+static long syscall_realloc(Machine<W>& machine)
+{
+	const auto ptr = machine.template sysarg<address_type<W>>(0);
+	const size_t len = machine.template sysarg<address_type<W>>(1);
+	auto* arena = state_of(machine).arena;
+	address_type<W> data = 0;
+	if (ptr == 0) {
+		data = arena->malloc(len);
+	}
+	else if (len == 0) {
+		arena->free(ptr);
+	}
+	else if (arena->resize(ptr, len)) {
+		data = ptr;
+	}
+	else if (const size_t old_len = arena->size(ptr); old_len != 0) {
+		data = arena->malloc(len);
+		if (data != 0) {
+			move_data(machine, data, ptr, std::min(len, old_len));
+			arena->free(ptr);
+		}
+	}
+	SYSPRINT("SYSCALL realloc(0x%X, %zu) = 0x%X\n", ptr, len, data);
+	return data;
+}
 template <int W>
 static long syscall_free(Machine<W>& machine)
 {
 	const auto ptr = machine.template sysarg<address_type<W>>(0);
-	int ret = arena.free(ptr);
+	int ret = state_of(machine).arena->free(ptr);
 	SYSPRINT("SYSCALL free(0x%X) = %d\n", ptr, ret);
 	return ret; /* avoid returning something here? */
 }
 
+// The page holding @addr, if the guest could read (or write) it directly.
+// Trapped and protected pages give nullptr, and must be accessed through
+// Memory::read() and write(), so that traps and faults happen as usual.
+template <int W>
+static const uint8_t* readable_page(Memory<W>& memory, address_type<W> addr)
+{
+	const auto& page = memory.get_page(addr);
+	if (page.has_trap() || !page.attr.read) return nullptr;
+	return page.data();
+}
+template <int W>
+static uint8_t* writable_page(Memory<W>& memory, address_type<W> addr)
+{
+	auto& page = memory.create_page(addr >> Page::SHIFT);
+	if (page.has_trap() || !page.attr.write) return nullptr;
+	return page.data();
+}
+static inline size_t page_remaining(uint64_t addr) {
+	return Page::size() - (addr & (Page::size()-1));
+}
 
+// memmove() on guest memory, in pieces that cross no page boundaries,
+// going backwards when the destination overlaps the end of the source
 template <int W>
-void setup_native_heap_syscalls(State<W>&, Machine<W>& machine, size_t max_memory)
+static void guest_memmove(Memory<W>& memory,
+	address_type<W> dst, address_type<W> src, size_t len)
 {
+	const bool backwards = dst > src && dst - src < len;
+	while (len != 0)
+	{
+		size_t size;
+		address_type<W> d = dst, s = src;
+		if (!backwards) {
+			size = std::min({page_remaining(dst), page_remaining(src), len});
+		} else {
+			// the last bytes, up to the start of a page
+			const auto end_offset = [] (address_type<W> end) {
+				return ((end - 1) & (Page::size()-1)) + 1;
+			};
+			size = std::min({end_offset(dst + len), end_offset(src + len), len});
+			d = dst + len - size;
+			s = src + len - size;
+		}
+		auto* to = writable_page(memory, d);
+		const auto* from = readable_page(memory, s);
+		if (LIKELY(to != nullptr && from != nullptr)) {
+			std::memmove(to + (d & (Page::size()-1)), from + (s & (Page::size()-1)), size);
+		} else if (!backwards) {
+			for (size_t i = 0; i < size; i++)
+				memory.template write<uint8_t> (d + i, memory.template read<uint8_t> (s + i));
+		} else {
+			for (size_t i = size; i-- > 0; )
+				memory.template write<uint8_t> (d + i, memory.template read<uint8_t> (s + i));
+		}
+		if (!backwards) {
+			dst += size;
+			src += size;
+		}
+		len -= size;
+	}
+}
+
+template <int W>
+static long syscall_memmove(Machine<W>& machine)
+{
+	const auto dst = machine.template sysarg<address_type<W>>(0);
+	const auto src = machine.template sysarg<address_type<W>>(1);
+	const size_t len = machine.template sysarg<address_type<W>>(2);
+	SYSPRINT("SYSCALL memmove(0x%X, 0x%X, %zu)\n", dst, src, len);
+	guest_memmove(machine.memory, dst, src, len);
+	return dst;
+}
+template <int W>
+static long syscall_memset(Machine<W>& machine)
+{
+	auto dst = machine.template sysarg<address_type<W>>(0);
+	const uint8_t value = machine.template sysarg<int>(1);
+	size_t len = machine.template sysarg<address_type<W>>(2);
+	SYSPRINT("SYSCALL memset(0x%X, %d, %zu)\n", dst, value, len);
+	const auto retval = dst;
+	while (len != 0)
+	{
+		const size_t size = std::min(page_remaining(dst), len);
+		auto* to = writable_page(machine.memory, dst);
+		if (LIKELY(to != nullptr)) {
+			std::memset(to + (dst & (Page::size()-1)), value, size);
+		} else {
+			for (size_t i = 0; i < size; i++)
+				machine.memory.template write<uint8_t> (dst + i, value);
+		}
+		dst += size;
+		len -= size;
+	}
+	return retval;
+}
+template <int W>
+static long syscall_memcmp(Machine<W>& machine)
+{
+	auto p1 = machine.template sysarg<address_type<W>>(0);
+	auto p2 = machine.template sysarg<address_type<W>>(1);
+	size_t len = machine.template sysarg<address_type<W>>(2);
+	SYSPRINT("SYSCALL memcmp(0x%X, 0x%X, %zu)\n", p1, p2, len);
+	auto& memory = machine.memory;
+	while (len != 0)
+	{
+		const size_t size = std::min({page_remaining(p1), page_remaining(p2), len});
+		const auto* s1 = readable_page(memory, p1);
+		const auto* s2 = readable_page(memory, p2);
+		if (LIKELY(s1 != nullptr && s2 != nullptr)) {
+			s1 += p1 & (Page::size()-1);
+			s2 += p2 & (Page::size()-1);
+			if (std::memcmp(s1, s2, size) != 0) {
+				while (*s1 == *s2) { s1++; s2++; }
+				return *s1 - *s2;
+			}
+		} else {
+			for (size_t i = 0; i < size; i++) {
+				const int diff = memory.template read<uint8_t> (p1 + i)
+							- memory.template read<uint8_t> (p2 + i);
+				if (diff != 0) return diff;
+			}
+		}
+		p1 += size;
+		p2 += size;
+		len -= size;
+	}
+	return 0;
+}
+template <int W>
+static long syscall_strlen(Machine<W>& machine)
+{
+	const auto str = machine.template sysarg<address_type<W>>(0);
+	auto& memory = machine.memory;
+	auto addr = str;
+	while (true)
+	{
+		const size_t size = page_remaining(addr);
+		const auto* data = readable_page(memory, addr);
+		if (LIKELY(data != nullptr)) {
+			data += addr & (Page::size()-1);
+			const auto* end = (const uint8_t*) std::memchr(data, 0, size);
+			if (end != nullptr) {
+				addr += end - data;
+				break;
+			}
+			addr += size;
+		} else {
+			if (memory.template read<uint8_t> (addr) == 0) break;
+			addr++;
+		}
+	}
+	SYSPRINT("SYSCALL strlen(0x%X) = %u\n", str, addr - str);
+	return addr - str;
+}
+template <int W>
+static long syscall_strcmp(Machine<W>& machine)
+{
+	auto p1 = machine.template sysarg<address_type<W>>(0);
+	auto p2 = machine.template sysarg<address_type<W>>(1);
+	SYSPRINT("SYSCALL strcmp(0x%X, 0x%X)\n", p1, p2);
+	auto& memory = machine.memory;
+	while (true)
+	{
+		const size_t size = std::min(page_remaining(p1), page_remaining(p2));
+		const auto* s1 = readable_page(memory, p1);
+		const auto* s2 = readable_page(memory, p2);
+		if (LIKELY(s1 != nullptr && s2 != nullptr)) {
+			s1 += p1 & (Page::size()-1);
+			s2 += p2 & (Page::size()-1);
+			for (size_t i = 0; i < size; i++) {
+				if (s1[i] != s2[i] || s1[i] == 0) return s1[i] - s2[i];
+			}
+		} else {
+			for (size_t i = 0; i < size; i++) {
+				const uint8_t c1 = memory.template read<uint8_t> (p1 + i);
+				const uint8_t c2 = memory.template read<uint8_t> (p2 + i);
+				if (c1 != c2 || c1 == 0) return c1 - c2;
+			}
+		}
+		p1 += size;
+		p2 += size;
+	}
+}
+
+
+template <int W>
+void setup_native_heap_syscalls(State<W>& state, Machine<W>& machine, size_t max_memory)
+{
+	// pages given back to the arena are given back to the machine
+	auto* arena = new sas_alloc::Arena(ARENA_BASE, ARENA_BASE + max_memory,
+		[&machine] (uint32_t addr, size_t len) {
+			machine.memory.free_pages(addr, len);
+		});
+	machine.add_destructor_callback([arena] { delete arena; });
+	state.arena = arena;
+	machine.set_userdata(&state);
+
 	machine.install_syscall_handler(SYSCALL_MALLOC, syscall_malloc<W>);
 	machine.install_syscall_handler(SYSCALL_CALLOC, syscall_calloc<W>);
+	machine.install_syscall_handler(SYSCALL_REALLOC, syscall_realloc<W>);
 	machine.install_syscall_handler(SYSCALL_FREE,   syscall_free<W>);
-	arena = sas_alloc::Arena(ARENA_BASE, ARENA_BASE + max_memory);
+}
+
+template <int W>
+void setup_native_memory_syscalls(Machine<W>& machine)
+{
+	// memcpy() is memmove(), as overlapping memcpy() is undefined anyway
+	machine.install_syscall_handler(SYSCALL_MEMCPY,  syscall_memmove<W>);
+	machine.install_syscall_handler(SYSCALL_MEMSET,  syscall_memset<W>);
+	machine.install_syscall_handler(SYSCALL_MEMMOVE, syscall_memmove<W>);
+	machine.install_syscall_handler(SYSCALL_MEMCMP,  syscall_memcmp<W>);
+	machine.install_syscall_handler(SYSCALL_STRLEN,  syscall_strlen<W>);
+	machine.install_syscall_handler(SYSCALL_STRCMP,  syscall_strcmp<W>);
 }
 
 /* le sigh */
 template void setup_native_heap_syscalls<4>(State<4>&, Machine<4>&, size_t);
+template void setup_native_memory_syscalls<4>(Machine<4>&);
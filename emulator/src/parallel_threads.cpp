@@ -0,0 +1,298 @@
+#include "threads.hpp"
+#include <algorithm>
+#include <cassert>
+#include <climits>
+#include <condition_variable>
+#include <cstdio>
+#include <memory>
+#include <sched.h>
+#include <thread>
+#include <unordered_map>
+using namespace riscv;
+
+// Runs every guest thread on its own host thread, with its own machine
+// sharing the memory of the main machine. System call handlers run one
+// at a time under the system call lock of the machines, which also
+// protects everything in here, except the exiting flag.
+template <int W>
+struct parallel_threads
+{
+	using address_t = address_type<W>;
+	// instructions between checking if the process is exiting
+	static constexpr uint64_t SLICE = 100'000;
+
+	struct thread_t {
+		int       tid;
+		address_t clear_tid = 0;
+		std::unique_ptr<Machine<W>> machine; // nullptr for the main thread
+		std::thread host;
+		std::atomic<bool> done {false};
+	};
+	struct waiter_t {
+		std::condition_variable cv;
+		bool woken = false;
+	};
+
+	thread_t& get_thread(Machine<W>&);
+	int  create(Machine<W>& parent, int flags, address_t ctid, address_t ptid,
+				address_t stack, address_t tls);
+	void exit_thread(thread_t&);
+	void exit_all();
+	long wait(Machine<W>&, address_t addr, uint32_t val);
+	int  wake(address_t addr, int count);
+
+	parallel_threads(Machine<W>& m) : main(m) { main_thread.tid = 0; }
+	~parallel_threads();
+
+	Machine<W>& main;
+	thread_t    main_thread;
+	std::unordered_map<const Machine<W>*, std::unique_ptr<thread_t>> threads;
+	std::unordered_map<address_t, std::deque<waiter_t*>> futexes;
+	int thread_counter = 0;
+	int running = 1; // threads that have not exited
+	int blocked = 0; // threads waiting on a futex
+	std::atomic<bool> exiting {false};
+
+private:
+	void run(thread_t*);
+	void reap();
+};
+
+template <int W>
+parallel_threads<W>::~parallel_threads()
+{
+	{
+		std::lock_guard<std::mutex> lock(*main.syscall_lock());
+		this->exit_all();
+	}
+	for (auto& it : threads) {
+		if (it.second->host.joinable()) it.second->host.join();
+	}
+}
+
+template <int W>
+typename parallel_threads<W>::thread_t& parallel_threads<W>::get_thread(Machine<W>& machine)
+{
+	if (&machine == &main) return main_thread;
+	auto it = threads.find(&machine);
+	assert(it != threads.end());
+	return *it->second;
+}
+
+template <int W>
+int parallel_threads<W>::create(Machine<W>& parent, int flags,
+	address_t ctid, address_t ptid, address_t stack, address_t tls)
+{
+	this->reap();
+	auto thread = std::make_unique<thread_t> ();
+	thread->tid = ++thread_counter;
+	thread->machine = std::make_unique<Machine<W>> (shared_memory, main);
+
+	auto& cpu = thread->machine->cpu;
+	cpu.registers() = parent.cpu.registers();
+	// the child continues after the ECALL, with clone() returning 0
+	cpu.registers().pc += 4;
+	cpu.reg(RISCV::REG_SP) = stack;
+	cpu.reg(RISCV::REG_TP) = tls;
+	cpu.reg(RISCV::REG_ARG0) = 0;
+
+	if (flags & CLONE_CHILD_SETTID) {
+		main.memory.template write<uint32_t> (ctid, thread->tid);
+	}
+	if (flags & CLONE_PARENT_SETTID) {
+		main.memory.template write<uint32_t> (ptid, thread->tid);
+	}
+	if (flags & CLONE_CHILD_CLEARTID) {
+		thread->clear_tid = ctid;
+	}
+	auto* t = thread.get();
+	running++;
+	threads.emplace(t->machine.get(), std::move(thread));
+	// the new thread has to wait for us to finish the system call
+	t->host = std::thread(&parallel_threads::run, this, t);
+	return t->tid;
+}
+
+template <int W>
+void parallel_threads<W>::run(thread_t* thread)
+{
+	auto& machine = *thread->machine;
+	try {
+		while (!exiting) {
+			machine.simulate(SLICE);
+			if (machine.stopped()) break;
+		}
+	} catch (const std::exception& e) {
+		fprintf(stderr, ">>> Exception on thread %d: %s\n", thread->tid, e.what());
+		// a crashing thread takes the whole process down
+		std::lock_guard<std::mutex> lock(*machine.syscall_lock());
+		this->running--;
+		this->exit_all();
+	}
+	thread->done = true;
+}
+
+template <int W>
+void parallel_threads<W>::reap()
+{
+	for (auto it = threads.begin(); it != threads.end(); ) {
+		if (it->second->done) {
+			it->second->host.join();
+			it = threads.erase(it);
+		} else ++it;
+	}
+}
+
+template <int W>
+void parallel_threads<W>::exit_thread(thread_t& thread)
+{
+	// CLONE_CHILD_CLEARTID: clear the TID and wake up joiners
+	if (thread.clear_tid) {
+		main.memory.template write<uint32_t> (thread.clear_tid, 0);
+		this->wake(thread.clear_tid, INT_MAX);
+	}
+	this->running--;
+	thread.machine->stop();
+}
+
+template <int W>
+void parallel_threads<W>::exit_all()
+{
+	this->exiting = true;
+	main.stop();
+	for (auto& it : threads) it.second->machine->stop();
+	for (auto& it : futexes) {
+		for (auto* waiter : it.second) waiter->cv.notify_one();
+	}
+}
+
+template <int W>
+long parallel_threads<W>::wait(Machine<W>& machine, address_t addr, uint32_t val)
+{
+	if (machine.memory.template read<uint32_t> (addr) != val)
+		return -EAGAIN;
+	if (blocked + 1 >= running) {
+		// every thread would be waiting
+		machine.cpu.trigger_exception(DEADLOCK_REACHED, addr);
+		return -EDEADLK;
+	}
+	waiter_t waiter;
+	auto& queue = futexes[addr];
+	queue.push_back(&waiter);
+	blocked++;
+	// wait on the system call lock, which we are already holding
+	std::unique_lock<std::mutex> lock(*machine.syscall_lock(), std::adopt_lock);
+	waiter.cv.wait(lock, [&] { return waiter.woken || exiting; });
+	lock.release();
+	blocked--;
+	if (!waiter.woken) {
+		auto& q = futexes[addr];
+		q.erase(std::find(q.begin(), q.end(), &waiter));
+		machine.stop();
+		return -EINTR;
+	}
+	return 0;
+}
+
+template <int W>
+int parallel_threads<W>::wake(address_t addr, int count)
+{
+	auto it = futexes.find(addr);
+	if (it == futexes.end()) return 0;
+	int woken = 0;
+	auto& queue = it->second;
+	while (woken < count && !queue.empty()) {
+		auto* waiter = queue.front();
+		queue.pop_front();
+		waiter->woken = true;
+		waiter->cv.notify_one();
+		woken++;
+	}
+	if (queue.empty()) futexes.erase(it);
+	return woken;
+}
+
+template <int W>
+void setup_parallel_threads(State<W>& state, Machine<W>& machine)
+{
+	// clone() runs under the lock, so it has to exist before the first
+	// clone, or the parent would not hold it while its child starts
+	machine.use_syscall_lock();
+	auto* pt = new parallel_threads<W>(machine);
+	machine.add_destructor_callback([pt] { delete pt; });
+
+	// exit
+	machine.install_syscall_handler(93,
+	[pt, &state] (Machine<W>& machine) -> long {
+		const int status = machine.template sysarg<int> (0);
+		auto& thread = pt->get_thread(machine);
+		THPRINT(">>> Exit on tid=%d, exit code = %d\n", thread.tid, status);
+		if (thread.tid != 0) {
+			pt->exit_thread(thread);
+			return status;
+		}
+		state.exit_code = status;
+		pt->exit_all();
+		return status;
+	});
+	// exit_group
+	machine.install_syscall_handler(94,
+	[pt, &state] (Machine<W>& machine) -> long {
+		state.exit_code = machine.template sysarg<int> (0);
+		pt->exit_all();
+		return state.exit_code;
+	});
+	// set_tid_address
+	machine.install_syscall_handler(96,
+	[pt] (Machine<W>& machine) -> long {
+		auto& thread = pt->get_thread(machine);
+		thread.clear_tid = machine.template sysarg<address_type<W>> (0);
+		return thread.tid;
+	});
+	// set_robust_list
+	machine.install_syscall_handler(99,
+	[] (Machine<W>&) -> long {
+		return 0;
+	});
+	// sched_yield: the host schedules our threads
+	machine.install_syscall_handler(124,
+	[] (Machine<W>&) -> long {
+		return 0;
+	});
+	// gettid
+	machine.install_syscall_handler(178,
+	[pt] (Machine<W>& machine) -> long {
+		return pt->get_thread(machine).tid;
+	});
+	// futex
+	machine.install_syscall_handler(98,
+	[pt] (Machine<W>& machine) -> long {
+		#define FUTEX_WAIT 0
+		#define FUTEX_WAKE 1
+		const auto addr = machine.template sysarg<address_type<W>> (0);
+		const int  futex_op = machine.template sysarg<int> (1);
+		const uint32_t  val = machine.template sysarg<uint32_t> (2);
+		THPRINT(">>> futex(0x%X, op=%d, val=%d)\n", addr, futex_op, val);
+		if ((futex_op & 0xF) == FUTEX_WAIT) {
+			return pt->wait(machine, addr, val);
+		} else if ((futex_op & 0xF) == FUTEX_WAKE) {
+			return pt->wake(addr, val);
+		}
+		return -ENOSYS;
+	});
+	// clone
+	machine.install_syscall_handler(220,
+	[pt] (Machine<W>& machine) -> long {
+		/* int clone(int (*fn)(void *arg), void *child_stack, int flags, void *arg,
+		             void *parent_tidptr, void *tls, void *child_tidptr) */
+		const int      flags = machine.template sysarg<int> (0);
+		const auto     stack = machine.template sysarg<address_type<W>> (1);
+		const auto      ptid = machine.template sysarg<address_type<W>> (4);
+		const auto       tls = machine.template sysarg<address_type<W>> (5);
+		const auto      ctid = machine.template sysarg<address_type<W>> (6);
+		return pt->create(machine, flags, ctid, ptid, stack, tls);
+	});
+}
+
+template
+void setup_parallel_threads<4>(State<4>&, Machine<4>& machine);
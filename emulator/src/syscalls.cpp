@@ -1,87 +1,141 @@
 #include "syscalls.hpp"
+#include "files.hpp"
+#include <climits>
+#include <mutex>
+#include <tuple>
+#include <type_traits>
 #include <unistd.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/uio.h>
 using namespace riscv;
-static constexpr uint32_t G_SHMEM_BASE = 0x70000000;
-static const uint32_t sbrk_start = 0x40000000;
-static const uint32_t sbrk_max   = sbrk_start + 0x1000000;
-static const uint32_t heap_start = sbrk_max;
-static const uint32_t heap_max   = 0xF0000000;
-
-struct iovec32 {
-    uint32_t iov_base;
-    int32_t  iov_len;
+
+struct timeval32 {
+	int32_t tv_sec;
+	int32_t tv_usec;
 };
 
 template <int W>
-long State<W>::syscall_exit(Machine<W>& machine)
+long State<W>::syscall_exit(Machine<W>& machine, int status)
 {
-	this->exit_code = machine.template sysarg<int> (0);
+	this->exit_code = status;
 	machine.stop();
 	return this->exit_code;
 }
 
+// Adds the guest memory at [addr, addr+len) to @vec as host buffers,
+// see Memory::gather()
+template <int W, bool WRITABLE = false>
+static bool gather_buffers(Machine<W>& machine, address_type<W> addr, size_t len,
+	std::vector<iovec>& vec)
+{
+	using data_t = std::conditional_t<WRITABLE, uint8_t, const uint8_t>;
+	thread_local std::vector<MemorySpan<data_t>> spans;
+	spans.clear();
+	bool ok;
+	if constexpr (WRITABLE)
+		ok = machine.memory.gather_writable(addr, len, spans);
+	else
+		ok = machine.memory.gather(addr, len, spans);
+	for (const auto& span : spans)
+		vec.push_back({(void*) span.ptr, span.len});
+	return ok;
+}
+
+// Hands the output to the sink, or to the host, IOV_MAX buffers at a
+// time, until everything has been written or a write comes up short
 template <int W>
-long State<W>::syscall_write(Machine<W>& machine)
+long State<W>::write_output(int fd, const std::vector<iovec>& vec)
 {
-	const int  fd      = machine.template sysarg<int>(0);
-	const auto address = machine.template sysarg<address_type<W>>(1);
-	const size_t len   = machine.template sysarg<address_type<W>>(2);
-	SYSPRINT("SYSCALL write: addr = 0x%X, len = %zu\n", address, len);
-	// we only accept standard pipes, for now :)
-	if (fd >= 0 && fd < 3) {
-		char buffer[1024];
-		const size_t len_g = std::min(sizeof(buffer), len);
-		machine.memory.memcpy_out(buffer, address, len_g);
-		output += std::string(buffer, len_g);
+	long total = 0;
+	for (size_t i = 0; i < vec.size(); i += IOV_MAX)
+	{
+		const int count = std::min(vec.size() - i, (size_t) IOV_MAX);
+		size_t wanted = 0;
+		for (int j = 0; j < count; j++) wanted += vec[i + j].iov_len;
+		long res;
+		if (output_sink != nullptr) {
+			res = output_sink(fd, &vec[i], count);
+		} else {
+			for (int j = 0; j < count; j++)
+				output.append((const char*) vec[i + j].iov_base, vec[i + j].iov_len);
 #ifdef RISCV_DEBUG
-		return write(fd, buffer, len);
+			res = writev(fd, &vec[i], count);
+			if (res < 0) res = -errno;
 #else
-		return len_g;
+			res = wanted;
 #endif
+		}
+		if (res < 0) return (total > 0) ? total : res;
+		total += res;
+		if ((size_t) res < wanted) break;
+	}
+	return total;
+}
+
+template <int W>
+long State<W>::syscall_write(Machine<W>& machine, int fd, address_type<W> addr, size_t len)
+{
+	SYSPRINT("SYSCALL write: addr = 0x%X, len = %zu\n", addr, len);
+	// we only accept standard pipes, for now :)
+	if (fd >= 0 && fd < 3) {
+		std::vector<iovec> vec;
+		if (!gather_buffers(machine, addr, len, vec))
+			return -EFAULT;
+		return write_output(fd, vec);
 	}
 	return -EBADF;
 }
 
 template <int W>
-long State<W>::syscall_writev(Machine<W>& machine)
+long State<W>::syscall_writev(Machine<W>& machine, int fd, GuestSpan<const iovec32> vec)
 {
-	const int  fd     = machine.template sysarg<int>(0);
-	const auto iov_g  = machine.template sysarg<uint32_t>(1);
-	const auto count  = machine.template sysarg<int>(2);
 	if constexpr (false) {
-		printf("SYSCALL writev called, iov = %#X  cnt = %d\n", iov_g, count);
+		printf("SYSCALL writev called, iov = %p  cnt = %zu\n", vec.data(), vec.size());
 	}
-	if (count < 0 || count > 256) return -EINVAL;
+	if (vec.size() > 256) return -EINVAL;
 	// we only accept standard pipes, for now :)
 	if (fd >= 0 && fd < 3) {
-        const size_t size = sizeof(iovec32) * count;
-
-        std::vector<iovec32> vec(count);
-        machine.memory.memcpy_out(vec.data(), iov_g, size);
-
-        int res = 0;
-        for (const auto& iov : vec)
-        {
-			char buffer[1024];
-            auto src_g = (uint32_t) iov.iov_base;
-            auto len_g = std::min(sizeof(buffer), (size_t) iov.iov_len);
-            machine.memory.memcpy_out(buffer, src_g, len_g);
-			output += std::string(buffer, len_g);
-#ifdef RISCV_DEBUG
-			res += write(fd, buffer, len_g);
-#else
-			res += len_g;
-#endif
-        }
-        return res;
+		std::vector<iovec> buffers;
+		for (const auto& iov : vec)
+		{
+			if (iov.iov_len < 0) return -EINVAL;
+			if (!gather_buffers(machine, iov.iov_base, iov.iov_len, buffers))
+				return -EFAULT;
+		}
+		return write_output(fd, buffers);
 	}
 	return -EBADF;
 }
 
+template <int W>
+long State<W>::syscall_ring_setup(Machine<W>& machine, address_type<W> addr)
+{
+	SYSPRINT("SYSCALL ring_setup: addr = 0x%X\n", addr);
+	const long res = SyscallRing<W>::validate(machine, addr);
+	if (res < 0) return res;
+	this->ring_addr = addr;
+	return 0;
+}
+
+template <int W>
+long State<W>::syscall_ring_enter(Machine<W>& machine)
+{
+	if (ring_addr == 0) return -EINVAL;
+	// the ring cannot be flushed from inside the ring
+	if (ring_busy) return -EBUSY;
+	ring_busy = true;
+	try {
+		const long res = SyscallRing<W>{machine, ring_addr}.process();
+		ring_busy = false;
+		return res;
+	} catch (...) {
+		ring_busy = false;
+		throw;
+	}
+}
+
 template <int W>
 long syscall_stub_zero(Machine<W>&) {
 	return 0;
@@ -94,11 +148,123 @@ long syscall_close(riscv::Machine<W>& machine)
 	if constexpr (verbose_syscalls) {
 		printf("SYSCALL close called, fd = %d\n", fd);
 	}
-	if (fd <= 2) {
+	if (fd >= 0 && fd <= 2) {
 		return 0;
 	}
-	printf(">>> Close %d\n", fd);
-	return -1;
+	auto* files = state_of(machine).files;
+	if (files != nullptr) {
+		return files->close(fd);
+	}
+	return -EBADF;
+}
+
+// the host fd of a file opened by the guest, or -1
+template <int W>
+static int host_fd_of(Machine<W>& machine, int fd)
+{
+	auto* files = state_of(machine).files;
+	return (files != nullptr) ? files->host_fd(fd) : -1;
+}
+
+// Reads from a host file straight into the pages of the guest,
+// at @offset, or at the file position when @offset is negative
+static long read_into(int hfd, const std::vector<iovec>& vec, int64_t offset)
+{
+	long total = 0;
+	for (size_t i = 0; i < vec.size(); i += IOV_MAX)
+	{
+		const int count = std::min(vec.size() - i, (size_t) IOV_MAX);
+		size_t wanted = 0;
+		for (int j = 0; j < count; j++) wanted += vec[i + j].iov_len;
+		const ssize_t res = (offset < 0) ?
+			readv(hfd, &vec[i], count) : preadv(hfd, &vec[i], count, offset + total);
+		if (res < 0) return (total > 0) ? total : -errno;
+		total += res;
+		if ((size_t) res < wanted) break; // end of file
+	}
+	return total;
+}
+
+template <int W>
+long syscall_read(Machine<W>& machine, int fd, address_type<W> addr, address_type<W> len)
+{
+	SYSPRINT("SYSCALL read: fd = %d, addr = 0x%X, len = %u\n", fd, addr, len);
+	const int hfd = host_fd_of(machine, fd);
+	if (hfd < 0) return -EBADF;
+	std::vector<iovec> vec;
+	if (!gather_buffers<W, true>(machine, addr, len, vec))
+		return -EFAULT;
+	return read_into(hfd, vec, -1);
+}
+
+template <int W>
+long syscall_readv(Machine<W>& machine, int fd, GuestSpan<const iovec32> vec)
+{
+	const int hfd = host_fd_of(machine, fd);
+	if (hfd < 0) return -EBADF;
+	if (vec.size() > 256) return -EINVAL;
+	std::vector<iovec> buffers;
+	for (const auto& iov : vec)
+	{
+		if (iov.iov_len < 0) return -EINVAL;
+		if (!gather_buffers<W, true>(machine, iov.iov_base, iov.iov_len, buffers))
+			return -EFAULT;
+	}
+	return read_into(hfd, buffers, -1);
+}
+
+template <int W>
+static long syscall_writev(Machine<W>& machine, int fd, GuestSpan<const iovec32> vec)
+{
+	return state_of(machine).syscall_writev(machine, fd, vec);
+}
+
+// Linux refuses iovec counts outside of [0, 256] with EINVAL before it
+// looks at the array, which a typed handler would report as EFAULT
+template <int W, long (*F)(Machine<W>&, int, GuestSpan<const iovec32>)>
+static long syscall_iovec(Machine<W>& machine)
+{
+	const int count = machine.template sysarg<int> (2);
+	if (count < 0 || count > 256) return -EINVAL;
+	static const auto typed = riscv::syscall_detail::make_handler<W>(F);
+	return typed(machine);
+}
+
+template <int W>
+long syscall_pread64(Machine<W>& machine)
+{
+	const int  fd  = machine.template sysarg<int>(0);
+	const auto addr = machine.template sysarg<address_type<W>>(1);
+	const auto len  = machine.template sysarg<address_type<W>>(2);
+	// the 64-bit offset takes two registers, low half first
+	const int64_t offset = machine.template sysarg<uint32_t>(3)
+		| (int64_t) machine.template sysarg<uint32_t>(4) << 32;
+	SYSPRINT("SYSCALL pread64: fd = %d, addr = 0x%X, len = %u, offset = %lld\n",
+		fd, addr, len, (long long) offset);
+	const int hfd = host_fd_of(machine, fd);
+	if (hfd < 0) return -EBADF;
+	if (offset < 0) return -EINVAL;
+	std::vector<iovec> vec;
+	if (!gather_buffers<W, true>(machine, addr, len, vec))
+		return -EFAULT;
+	return read_into(hfd, vec, offset);
+}
+
+template <int W>
+long syscall_llseek(Machine<W>& machine, int fd, uint32_t offset_hi,
+	uint32_t offset_lo, int64_t* result, int whence)
+{
+	const int hfd = host_fd_of(machine, fd);
+	if (hfd < 0) return -ESPIPE;
+	if (whence != SEEK_SET && whence != SEEK_CUR && whence != SEEK_END)
+		return -EINVAL;
+	// checked before seeking, so that a failed call moves nothing
+	if (result == nullptr) return -EFAULT;
+	const int64_t offset = (int64_t) ((uint64_t) offset_hi << 32 | offset_lo);
+	const off_t res = lseek(hfd, offset, whence);
+	if (res < 0) return -errno;
+	*result = res;
+	return 0;
 }
 
 template <int W>
@@ -114,23 +280,31 @@ long syscall_ebreak(riscv::Machine<W>& machine)
 }
 
 template <int W>
-long syscall_gettimeofday(Machine<W>& machine)
+long syscall_gettimeofday(Machine<W>&, timeval32* buffer)
 {
-	const auto buffer = machine.template sysarg<address_type<W>>(0);
-	SYSPRINT("SYSCALL gettimeofday called, buffer = 0x%X\n", buffer);
-	struct timeval tv;
-	gettimeofday(&tv, nullptr);
-	int32_t timeval32[2] = { (int) tv.tv_sec, (int) tv.tv_usec };
-	machine.copy_to_guest(buffer, timeval32, sizeof(timeval32));
+	SYSPRINT("SYSCALL gettimeofday called, buffer = %p\n", buffer);
+	if (buffer != nullptr) {
+		struct timeval tv;
+		gettimeofday(&tv, nullptr);
+		*buffer = { (int32_t) tv.tv_sec, (int32_t) tv.tv_usec };
+	}
     return 0;
 }
 
 template <int W>
 long syscall_openat(Machine<W>& machine)
 {
-	const int fd = machine.template sysarg<int>(0);
-	SYSPRINT("SYSCALL openat called, fd = %d  \n", fd);
-    return -EBADF;
+	const int dirfd = machine.template sysarg<int>(0);
+	const auto g_path = machine.template sysarg<address_type<W>>(1);
+	const int flags = machine.template sysarg<int>(2);
+	auto* files = state_of(machine).files;
+	if (files == nullptr) return -ENOENT;
+	const auto path = machine.memory.memstring(g_path, PATH_MAX);
+	SYSPRINT("SYSCALL openat called, dirfd = %d  path = %s\n", dirfd, path.c_str());
+	// the working directory is the sandbox directory
+	if (dirfd != AT_FDCWD && (path.empty() || path[0] != '/'))
+		return -EBADF;
+	return files->open(path, flags);
 }
 
 template <int W>
@@ -144,127 +318,354 @@ long syscall_readlinkat(Machine<W>& machine)
 template <int W>
 long syscall_brk(Machine<W>& machine)
 {
-	static uint32_t sbrk_end = sbrk_start;
+	auto& state = state_of(machine);
 	const uint32_t new_end = machine.template sysarg<uint32_t>(0);
 	if constexpr (verbose_syscalls) {
-		printf("SYSCALL brk called, current = 0x%X new = 0x%X\n", sbrk_end, new_end);
+		printf("SYSCALL brk called, current = 0x%X new = 0x%X\n", state.sbrk_end, new_end);
+	}
+	// like Linux, a break outside of the area leaves it where it was
+	if (new_end < state.brk_begin || new_end > state.brk_max)
+		return state.sbrk_end;
+
+	if (new_end < state.sbrk_end)
+	{
+		// give back the pages above the new break, and clear the rest
+		// of its page, so that growing again only ever reveals zeroes
+		const uint32_t page_end = MmapArea::page_align(new_end);
+		machine.memory.free_pages(page_end,
+			MmapArea::page_align(state.sbrk_end) - page_end);
+		if (page_end != new_end && &machine.memory.get_page(new_end) != &Page::cow_page())
+			machine.memory.memset(new_end, 0, page_end - new_end);
+	}
+	state.sbrk_end = new_end;
+
+	if constexpr (verbose_syscalls) {
+		printf("* New sbrk() end: 0x%X\n", state.sbrk_end);
 	}
-    if (new_end == 0) return sbrk_end;
-    sbrk_end = new_end;
-    sbrk_end = std::max(sbrk_end, sbrk_start);
-    sbrk_end = std::min(sbrk_end, sbrk_max);
+	return state.sbrk_end;
+}
+
+// struct stat64 of 32-bit RISC-V Linux
+struct stat32 {
+	uint64_t st_dev;
+	uint64_t st_ino;
+	uint32_t st_mode;
+	uint32_t st_nlink;
+	uint32_t st_uid;
+	uint32_t st_gid;
+	uint64_t st_rdev;
+	uint64_t pad1;
+	int64_t  st_size;
+	int32_t  st_blksize;
+	int32_t  pad2;
+	int64_t  st_blocks;
+	int32_t  st_atime_sec;
+	uint32_t st_atime_nsec;
+	int32_t  st_mtime_sec;
+	uint32_t st_mtime_nsec;
+	int32_t  st_ctime_sec;
+	uint32_t st_ctime_nsec;
+	uint32_t unused4;
+	uint32_t unused5;
+};
 
+template <int W>
+long syscall_fstat(Machine<W>& machine, int fd, stat32* buffer)
+{
 	if constexpr (verbose_syscalls) {
-		printf("* New sbrk() end: 0x%X\n", sbrk_end);
+		printf("SYSCALL fstat called, fd = %d  buffer = %p\n", fd, buffer);
 	}
-	return sbrk_end;
+	const int hfd = host_fd_of(machine, fd);
+	if (hfd < 0) return -EBADF;
+	if (buffer == nullptr) return -EFAULT;
+	struct stat st;
+	if (fstat(hfd, &st) < 0) return -errno;
+	*buffer = {};
+	buffer->st_dev   = st.st_dev;
+	buffer->st_ino   = st.st_ino;
+	buffer->st_mode  = st.st_mode & ~0222; // read-only
+	buffer->st_nlink = 1;
+	buffer->st_size  = st.st_size;
+	buffer->st_blksize = st.st_blksize;
+	buffer->st_blocks  = st.st_blocks;
+	buffer->st_atime_sec = st.st_atim.tv_sec;
+	buffer->st_mtime_sec = st.st_mtim.tv_sec;
+	buffer->st_ctime_sec = st.st_ctim.tv_sec;
+	return 0;
 }
 
+static constexpr int UTSLEN = 65;
+struct uts32 {
+	char sysname [UTSLEN];
+	char nodename[UTSLEN];
+	char release [UTSLEN];
+	char version [UTSLEN];
+	char machine [UTSLEN];
+	char domain  [UTSLEN];
+};
+
 template <int W>
-long syscall_stat(Machine<W>& machine)
+long syscall_uname(Machine<W>&, uts32* uts)
 {
-	const auto  fd      = machine.template sysarg<int>(0);
-	const auto  buffer  = machine.template sysarg<uint32_t>(1);
 	if constexpr (verbose_syscalls) {
-		printf("SYSCALL stat called, fd = %d  buffer = 0x%X\n",
-				fd, buffer);
+		printf("SYSCALL uname called, buffer = %p\n", uts);
 	}
-	if (false) {
-		struct stat result;
-		std::memset(&result, 0, sizeof(result));
-		result.st_dev     = 6;
-		result.st_ino     = fd;
-		result.st_mode    = 0x21b6;
-		result.st_nlink   = 1;
-		result.st_rdev    = 265;
-		result.st_blksize = 512;
-		result.st_blocks  = 0;
-		machine.copy_to_guest(buffer, &result, sizeof(result));
+	if (uts == nullptr) return -EFAULT;
+    strcpy(uts->sysname, "RISC-V C++ Emulator");
+    strcpy(uts->nodename,"libriscv");
+    strcpy(uts->release, "5.0.0");
+    strcpy(uts->version, "");
+    strcpy(uts->machine, "rv32imac");
+    strcpy(uts->domain,  "(none)");
+	return 0;
+}
+
+// Reads the file behind @fd into freshly mapped guest pages. Only the
+// part of the mapping that the file covers is created, and the rest
+// stays zero pages until touched.
+template <int W>
+static long map_file(Machine<W>& machine, int fd, uint32_t addr, uint32_t len, int64_t offset)
+{
+	const int hfd = host_fd_of(machine, fd);
+	if (hfd < 0) return -EBADF;
+	struct stat st;
+	if (fstat(hfd, &st) < 0) return -errno;
+	if (offset >= st.st_size) return 0;
+	const uint32_t size = std::min((int64_t) len, st.st_size - offset);
+	std::vector<iovec> vec;
+	if (!gather_buffers<W, true>(machine, addr, size, vec))
+		return -EFAULT;
+	const long res = read_into(hfd, vec, offset);
+	return (res < 0) ? res : 0;
+}
+
+// The host-owned pages holding @len bytes of the file at @offset, which
+// are read once and then shared by every guest mapping the same part of
+// the same version of the file, for as long as any of them does
+static long shared_file_region(int hfd, const struct stat& st, int64_t offset,
+	uint32_t len, std::shared_ptr<SharedRegion>& region)
+{
+	using key_t = std::tuple<dev_t, ino_t, time_t, long, off_t, int64_t, uint32_t>;
+	static std::mutex lock;
+	static std::map<key_t, std::weak_ptr<SharedRegion>> regions;
+	const key_t key { st.st_dev, st.st_ino, st.st_mtim.tv_sec, st.st_mtim.tv_nsec,
+		st.st_size, offset, len };
+
+	std::lock_guard<std::mutex> guard(lock);
+	auto it = regions.find(key);
+	if (it != regions.end() && (region = it->second.lock()) != nullptr)
 		return 0;
+	// forget the regions that are no longer mapped anywhere
+	for (auto it = regions.begin(); it != regions.end(); ) {
+		it = it->second.expired() ? regions.erase(it) : std::next(it);
 	}
-	return -EBADF;
+	auto created = std::make_shared<SharedRegion>(len);
+	std::vector<iovec> vec;
+	for (size_t n = 0; n < created->pages(); n++)
+		vec.push_back({created->page(n).data(), Page::size()});
+	const long res = read_into(hfd, vec, offset);
+	if (res < 0) return res;
+	regions[key] = created;
+	region = std::move(created);
+	return 0;
 }
 
+// Maps the file behind @fd for reading only, using the pages that other
+// guests share (see shared_file_region), which are counted against the
+// memory of the guest when mapped all the same. Pages past the end of
+// the file can't be accessed, like on Linux.
 template <int W>
-long syscall_uname(Machine<W>& machine)
+static long map_file_shared(Machine<W>& machine, int fd, uint32_t addr, uint32_t len,
+	int64_t offset, bool read, bool shared)
 {
-	const auto buffer = machine.template sysarg<uint32_t>(0);
-	if constexpr (verbose_syscalls) {
-		printf("SYSCALL uname called, buffer = 0x%X\n", buffer);
+	auto& state = state_of(machine);
+	auto& memory = machine.memory;
+	const int hfd = host_fd_of(machine, fd);
+	if (hfd < 0) return -EBADF;
+	struct stat st;
+	if (fstat(hfd, &st) < 0) return -errno;
+	const uint32_t size = (offset < st.st_size) ?
+		MmapArea::page_align(std::min((int64_t) len, st.st_size - offset)) : 0;
+	if (size > 0)
+	{
+		size_t pages = memory.pages_active() + size / Page::size();
+		for (const auto& it : state.file_mappings)
+			pages += it.second.region->pages();
+		if (pages > memory.pages_total()) return -ENOMEM;
+
+		std::shared_ptr<SharedRegion> region;
+		const long res = shared_file_region(hfd, st, offset, size, region);
+		if (res < 0) return res;
+		memory.map_shared(addr, region, { .read = read, .write = false });
+		state.file_mappings[addr] = { std::move(region), read, shared };
 	}
-    static constexpr int UTSLEN = 65;
-    struct uts32 {
-        char sysname [UTSLEN];
-        char nodename[UTSLEN];
-        char release [UTSLEN];
-        char version [UTSLEN];
-        char machine [UTSLEN];
-        char domain  [UTSLEN];
-    } uts;
-    strcpy(uts.sysname, "RISC-V C++ Emulator");
-    strcpy(uts.nodename,"libriscv");
-    strcpy(uts.release, "5.0.0");
-    strcpy(uts.version, "");
-    strcpy(uts.machine, "rv32imac");
-    strcpy(uts.domain,  "(none)");
-
-    machine.copy_to_guest(buffer, &uts, sizeof(uts32));
+	if (size < len)
+		memory.set_page_attr(addr + size, len - size, { .read = false, .write = false });
 	return 0;
 }
 
+// The addresses of the shared file mappings that overlap [addr, addr+len)
+template <int W>
+static std::vector<uint32_t> file_mappings_in(State<W>& state, uint32_t addr, uint32_t len)
+{
+	std::vector<uint32_t> result;
+	for (const auto& it : state.file_mappings) {
+		if (it.first < (uint64_t) addr + len && it.first + it.second.region->size() > addr)
+			result.push_back(it.first);
+	}
+	return result;
+}
+
+// Replaces the shared file mapping at @start with private pages that
+// have the same contents and permissions, except for the pages in
+// [skip, skip+skip_len), which are left unmapped
+template <int W>
+static void unshare_file(Machine<W>& machine, uint32_t start,
+	uint32_t skip = 0, uint32_t skip_len = 0)
+{
+	auto& mappings = state_of(machine).file_mappings;
+	auto it = mappings.find(start);
+	const FileMapping mapping = std::move(it->second);
+	mappings.erase(it);
+	machine.memory.unmap_shared(start);
+	for (size_t n = 0; n < mapping.region->pages(); n++)
+	{
+		const uint32_t addr = start + n * Page::size();
+		if (addr - skip < skip_len) continue;
+		machine.memory.memcpy(addr, mapping.region->page(n).data(), Page::size());
+		machine.memory.set_page_attr(addr, Page::size(),
+			{ .read = mapping.read, .write = false });
+	}
+}
+
+// Everything in [addr, addr+len) is unmapped, including what was
+// never in the mmap area, and its pages are given back
 template <int W>
-inline void add_mman_syscalls(Machine<W>& machine)
+static void unmap_range(Machine<W>& machine, uint32_t addr, uint32_t len)
+{
+	auto& state = state_of(machine);
+	for (const uint32_t start : file_mappings_in(state, addr, len))
+		unshare_file(machine, start, addr, len);
+	machine.memory.free_pages(addr, len);
+	if (state.mmap_area.contains(addr, len)) state.mmap_area.release(addr, len);
+}
+
+template <int W, typename Target>
+inline void add_mman_syscalls(Target& machine)
 {
 	// munmap
 	machine.install_syscall_handler(215,
-	[] (Machine<W>& machine) {
+	[] (Machine<W>& machine) -> long {
 		const uint32_t addr = machine.template sysarg<uint32_t> (0);
-		const uint32_t len  = machine.template sysarg<uint32_t> (1);
+		const uint32_t len  = MmapArea::page_align(machine.template sysarg<uint32_t> (1));
 		SYSPRINT(">>> munmap(0x%X, len=%u)\n", addr, len);
-		// TODO: deallocate pages completely
-		machine.memory.set_page_attr(addr, len, {
-			.read  = false,
-			.write = false,
-			.exec  = false
-		});
+		if (addr % Page::size() != 0 || len == 0) return -EINVAL;
+		unmap_range(machine, addr, len);
 		return 0;
 	});
-	// mmap
+	// mmap2
 	machine.install_syscall_handler(222,
-	[] (Machine<W>& machine) {
-		const int  addr_g = machine.template sysarg<address_type<W>>(0);
-		const auto length = machine.template sysarg<address_type<W>>(1);
+	[] (Machine<W>& machine) -> long {
+		const auto addr_g = machine.template sysarg<uint32_t>(0);
+		const auto length = MmapArea::page_align(machine.template sysarg<uint32_t>(1));
 		const auto prot   = machine.template sysarg<int>(2);
-	    const auto flags  = machine.template sysarg<int>(3);
+		const auto flags  = machine.template sysarg<int>(3);
+		const auto fd     = machine.template sysarg<int>(4);
+		// the offset is in pages
+		const int64_t offset = (int64_t) machine.template sysarg<uint32_t>(5) * Page::size();
 		SYSPRINT("SYSCALL mmap called, addr %#X  len %u prot %#x flags %#X\n",
-	            addr_g, length, prot, flags);
-	    if (addr_g == 0 && (length % Page::size()) == 0)
-	    {
-	        static uint32_t nextfree = heap_start;
-	        const uint32_t addr = nextfree;
-			// anon pages need to be zeroed
-			if (flags & MAP_ANONYMOUS) {
-				// ... but they are already CoW
-				//machine.memory.memset(addr, 0, length);
+				addr_g, length, prot, flags);
+		if (length == 0 || addr_g % Page::size() != 0)
+			return -EINVAL;
+		const bool anonymous = (flags & MAP_ANONYMOUS);
+		// sandboxed files are only ever opened for reading, and
+		// Linux refuses to map those shared and writable
+		if (!anonymous && (flags & MAP_SHARED) && (prot & PROT_WRITE))
+			return -EACCES;
+
+		auto& area = state_of(machine).mmap_area;
+		uint32_t addr = addr_g;
+		if (flags & MAP_FIXED) {
+			unmap_range(machine, addr, length);
+			if (area.contains(addr, length)) area.allocate_at(addr, length);
+		} else if (addr == 0 || !area.allocate_at(addr, length)) {
+			// the hint is taken when it is free
+			addr = area.allocate(length);
+			if (addr == 0) return -ENOMEM;
+		}
+		// released pages read as zeroes, until they are written to
+		machine.memory.free_pages(addr, length);
+		if (!anonymous && !(prot & (PROT_WRITE | PROT_EXEC))) {
+			const long res = map_file_shared(machine, fd, addr, length, offset,
+				prot & PROT_READ, flags & MAP_SHARED);
+			if (res < 0) {
+				unmap_range(machine, addr, length);
+				return res;
+			}
+			return addr;
+		}
+		if (!anonymous) {
+			const long res = map_file(machine, fd, addr, length, offset);
+			if (res < 0) {
+				unmap_range(machine, addr, length);
+				return res;
 			}
-	        nextfree += length;
-	        return addr;
-	    }
-		return UINT32_MAX; // = MAP_FAILED;
+		}
+		// pages only have to be created for unusual permissions, but
+		// not for PROT_NONE guard pages and reservations
+		if (prot != (PROT_READ | PROT_WRITE)) {
+			machine.memory.set_page_attr(addr, length, {
+				.read  = bool(prot & PROT_READ),
+				.write = bool(prot & PROT_WRITE),
+				.exec  = bool(prot & PROT_EXEC)
+			});
+		}
+		return addr;
 	});
 	// mremap
 	machine.install_syscall_handler(163,
 	[] (Machine<W>& machine) -> long {
-		const auto old_addr = machine.template sysarg<address_type<W>>(0);
-		const auto old_size = machine.template sysarg<address_type<W>>(1);
-		const auto new_size = machine.template sysarg<address_type<W>>(2);
-	    const auto flags    = machine.template sysarg<int>(3);
+		const auto old_addr = machine.template sysarg<uint32_t>(0);
+		const auto old_size = MmapArea::page_align(machine.template sysarg<uint32_t>(1));
+		const auto new_size = MmapArea::page_align(machine.template sysarg<uint32_t>(2));
+		const auto flags    = machine.template sysarg<int>(3);
 		SYSPRINT("SYSCALL mremap called, addr %#X  len %u newsize %u flags %#X\n",
-	            old_addr, old_size, new_size, flags);
-		if (flags & MREMAP_FIXED) {
-			return (long) MAP_FAILED;
+				old_addr, old_size, new_size, flags);
+		auto& area = state_of(machine).mmap_area;
+		if (old_addr % Page::size() != 0 || new_size == 0 || (flags & MREMAP_FIXED))
+			return -EINVAL;
+		if (!area.contains(old_addr, old_size))
+			return -EFAULT;
+		// shared file pages stay where they are mapped
+		for (const uint32_t start : file_mappings_in(state_of(machine), old_addr, old_size))
+			unshare_file(machine, start);
+		if (new_size <= old_size) {
+			if (new_size < old_size)
+				unmap_range(machine, old_addr + new_size, old_size - new_size);
+			return old_addr;
 		}
-		return (long) MAP_FAILED;
+		// the new tail gets the permissions of the end of the mapping
+		const auto& last = machine.memory.get_page_attr(old_addr + old_size - 1);
+		const PageAttributes attr {
+			.read = last.read, .write = last.write, .exec = last.exec
+		};
+		const uint32_t tail = new_size - old_size;
+		// grow in place when the pages after us are free
+		if (area.allocate_at(old_addr + old_size, tail)) {
+			machine.memory.free_pages(old_addr + old_size, tail);
+			if (!attr.is_default())
+				machine.memory.set_page_attr(old_addr + old_size, tail, attr);
+			return old_addr;
+		}
+		if (!(flags & MREMAP_MAYMOVE)) return -ENOMEM;
+		const uint32_t new_addr = area.allocate(new_size);
+		if (new_addr == 0) return -ENOMEM;
+		machine.memory.free_pages(new_addr, new_size);
+		machine.memory.move_pages(new_addr, old_addr, old_size);
+		area.release(old_addr, old_size);
+		if (!attr.is_default())
+			machine.memory.set_page_attr(new_addr + old_size, tail, attr);
+		return new_addr;
 	});
 	// mprotect
 	machine.install_syscall_handler(226,
@@ -273,6 +674,15 @@ inline void add_mman_syscalls(Machine<W>& machine)
 		const uint32_t len  = machine.template sysarg<uint32_t> (1);
 		const int      prot = machine.template sysarg<int> (2);
 		SYSPRINT(">>> mprotect(0x%X, len=%u, prot=%x)\n", addr, len, prot);
+		auto& state = state_of(machine);
+		for (const uint32_t start : file_mappings_in(state, addr, len)) {
+			const auto& mapping = state.file_mappings[start];
+			if (mapping.shared && (prot & PROT_WRITE))
+				return -EACCES;
+			// the permissions of shared pages belong to their mapping
+			if (mapping.read != bool(prot & PROT_READ) || (prot & (PROT_WRITE | PROT_EXEC)))
+				unshare_file(machine, start);
+		}
 		machine.memory.set_page_attr(addr, len, {
 			.read  = bool(prot & 1),
 			.write = bool(prot & 2),
@@ -306,26 +716,42 @@ inline void add_mman_syscalls(Machine<W>& machine)
 	});
 }
 
-template <int W>
-inline void setup_minimal_syscalls(State<W>& state, Machine<W>& machine)
+// Handlers are installed into either a machine or a shared table,
+// and find their State through the userdata of the calling machine.
+template <int W, typename Target>
+static void add_minimal_syscalls(Target& machine)
 {
 	machine.install_syscall_handler(SYSCALL_EBREAK, syscall_ebreak<W>);
-	machine.install_syscall_handler(64, {&state, &State<W>::syscall_write});
-	machine.install_syscall_handler(93, {&state, &State<W>::syscall_exit});
+	machine.template install_syscall<64>(
+		[] (Machine<W>& machine, int fd, address_type<W> addr, address_type<W> len) {
+			return state_of(machine).syscall_write(machine, fd, addr, len);
+		});
+	machine.template install_syscall<93>(
+		[] (Machine<W>& machine, int status) {
+			return state_of(machine).syscall_exit(machine, status);
+		});
+	machine.template install_syscall<SYSCALL_RING_SETUP>(
+		[] (Machine<W>& machine, address_type<W> addr) {
+			return state_of(machine).syscall_ring_setup(machine, addr);
+		});
+	machine.template install_syscall<SYSCALL_RING_ENTER>(
+		[] (Machine<W>& machine) {
+			return state_of(machine).syscall_ring_enter(machine);
+		});
 }
 
-template <int W>
-inline void setup_newlib_syscalls(State<W>& state, Machine<W>& machine)
+template <int W, typename Target>
+static void add_newlib_syscalls(Target& machine)
 {
-	setup_minimal_syscalls<W>(state, machine);
+	add_minimal_syscalls<W>(machine);
 	machine.install_syscall_handler(214, syscall_brk<W>);
-	add_mman_syscalls(machine);
+	add_mman_syscalls<W>(machine);
 }
 
-template <int W>
-void setup_linux_syscalls(State<W>& state, Machine<W>& machine)
+template <int W, typename Target>
+static void add_linux_syscalls(Target& machine)
 {
-	setup_minimal_syscalls<W>(state, machine);
+	add_minimal_syscalls<W>(machine);
 
 	// fcntl
 	machine.install_syscall_handler(25, syscall_stub_zero<W>);
@@ -334,7 +760,7 @@ void setup_linux_syscalls(State<W>& state, Machine<W>& machine)
 	// rt_sigprocmask
 	machine.install_syscall_handler(135, syscall_stub_zero<W>);
 	// rt_sigprocmask
-	machine.install_syscall_handler(169, syscall_gettimeofday<W>);
+	machine.template install_syscall<169>(syscall_gettimeofday<W>);
 	// getpid
 	machine.install_syscall_handler(172, syscall_stub_zero<W>);
 	// getuid
@@ -348,41 +774,98 @@ void setup_linux_syscalls(State<W>& state, Machine<W>& machine)
 
 	machine.install_syscall_handler(56, syscall_openat<W>);
 	machine.install_syscall_handler(57, syscall_close<W>);
-	machine.install_syscall_handler(66, {&state, &State<W>::syscall_writev});
+	machine.template install_syscall<62>(syscall_llseek<W>);
+	machine.template install_syscall<63>(syscall_read<W>);
+	machine.install_syscall_handler(65, syscall_iovec<W, syscall_readv<W>>);
+	machine.install_syscall_handler(67, syscall_pread64<W>);
+	machine.install_syscall_handler(66, syscall_iovec<W, syscall_writev<W>>);
 	machine.install_syscall_handler(78, syscall_readlinkat<W>);
-	machine.install_syscall_handler(80, syscall_stat<W>);
+	machine.template install_syscall<80>(syscall_fstat<W>);
 
-	machine.install_syscall_handler(160, syscall_uname<W>);
+	machine.template install_syscall<160>(syscall_uname<W>);
 	machine.install_syscall_handler(214, syscall_brk<W>);
 
-	add_mman_syscalls(machine);
+	add_mman_syscalls<W>(machine);
 
 	// statx
-	machine.install_syscall_handler(291,
-	[] (Machine<W>& machine) {
-		struct statx {
-			uint32_t stx_mask;
-			uint32_t stx_blksize = 512;
-			uint64_t stx_attributes;
-			uint32_t stx_nlink = 1;
-			uint32_t stx_uid = 0;
-			uint32_t stx_gid = 0;
-			uint32_t stx_mode = S_IFCHR;
-		};
-		const int      fd   = machine.template sysarg<int> (0);
-		const uint32_t path = machine.template sysarg<uint32_t> (1);
-		const int     flags = machine.template sysarg<int> (2);
-		const uint32_t buffer = machine.template sysarg<uint32_t> (4);
-		SYSPRINT(">>> xstat(fd=%d, path=0x%X, flags=%x, buf=0x%X)\n",
+	struct statx32 {
+		uint32_t stx_mask;
+		uint32_t stx_blksize;
+		uint64_t stx_attributes;
+		uint32_t stx_nlink;
+		uint32_t stx_uid;
+		uint32_t stx_gid;
+		uint32_t stx_mode;
+	};
+	machine.template install_syscall<291>(
+	[] (Machine<W>&, int fd, address_type<W> path, int flags,
+		unsigned /* mask */, statx32* buffer) {
+		SYSPRINT(">>> xstat(fd=%d, path=0x%X, flags=%x, buf=%p)\n",
 				fd, path, flags, buffer);
-		statx s;
-		s.stx_mask = flags;
-		machine.copy_to_guest(buffer, &s, sizeof(statx));
+		(void) fd; (void) path;
+		if (buffer == nullptr) return -EFAULT;
+		*buffer = {
+			.stx_mask = (uint32_t) flags,
+			.stx_blksize = 512,
+			.stx_attributes = 0,
+			.stx_nlink = 1,
+			.stx_uid = 0,
+			.stx_gid = 0,
+			.stx_mode = S_IFCHR
+		};
 		return 0;
 	});
 }
 
+template <int W>
+void setup_minimal_syscalls(State<W>& state, Machine<W>& machine)
+{
+	machine.set_userdata(&state);
+	add_minimal_syscalls<W>(machine);
+}
+template <int W>
+void setup_minimal_syscalls(SyscallTable<W>& table)
+{
+	add_minimal_syscalls<W>(table);
+}
+
+template <int W>
+void setup_newlib_syscalls(State<W>& state, Machine<W>& machine)
+{
+	machine.set_userdata(&state);
+	add_newlib_syscalls<W>(machine);
+}
+template <int W>
+void setup_newlib_syscalls(SyscallTable<W>& table)
+{
+	add_newlib_syscalls<W>(table);
+}
+
+template <int W>
+void setup_linux_syscalls(State<W>& state, Machine<W>& machine)
+{
+	machine.set_userdata(&state);
+	add_linux_syscalls<W>(machine);
+}
+template <int W>
+void setup_linux_syscalls(SyscallTable<W>& table)
+{
+	add_linux_syscalls<W>(table);
+}
+
+template <int W>
+void setup_sandboxed_files(State<W>& state, Machine<W>& machine, const std::string& directory)
+{
+	auto* files = new FileTable(directory);
+	machine.add_destructor_callback([files] { delete files; });
+	state.files = files;
+}
+
 /* le sigh */
 template void setup_minimal_syscalls<4>(State<4>&, Machine<4>&);
 template void setup_newlib_syscalls<4>(State<4>&, Machine<4>&);
 template void setup_linux_syscalls<4>(State<4>&, Machine<4>&);
+template void setup_minimal_syscalls<4>(SyscallTable<4>&);
+template void setup_newlib_syscalls<4>(SyscallTable<4>&);
+template void setup_linux_syscalls<4>(SyscallTable<4>&);
+template void setup_sandboxed_files<4>(State<4>&, Machine<4>&, const std::string&);
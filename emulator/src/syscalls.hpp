@@ -1,5 +1,10 @@
 #pragma once
 #include <libriscv/machine.hpp>
+#include <libriscv/syscall_ring.hpp>
+#include "mmap_area.hpp"
+#include <functional>
+#include <map>
+#include <sys/uio.h>
 static constexpr bool verbose_syscalls = false;
 
 //#define SYSCALL_VERBOSE 1
@@ -9,17 +14,93 @@ static constexpr bool verbose_syscalls = false;
 #define SYSPRINT(fmt, ...) /* fmt */
 #endif
 
+static constexpr uint32_t SBRK_START = 0x40000000;
+static constexpr uint32_t SBRK_MAX   = SBRK_START + 0x1000000;
+static constexpr uint32_t HEAP_START = SBRK_MAX;
+static constexpr uint32_t HEAP_END   = 0x70000000;
+// where hosts map regions shared between guests (see SharedRegion)
+static constexpr uint32_t SHMEM_BASE = HEAP_END;
+
+namespace sas_alloc { struct Arena; }
+struct FileTable;
+template <int W> struct multithreading;
+
+// submission/completion ring, see libriscv/syscall_ring.hpp
+static constexpr int SYSCALL_RING_SETUP = 502;
+static constexpr int SYSCALL_RING_ENTER = 503;
+
+// A file mapping backed by host-owned pages, which every guest that maps
+// the same part of the same file shares (see map_file_shared)
+struct FileMapping {
+	std::shared_ptr<riscv::SharedRegion> region;
+	bool read;
+	bool shared; // MAP_SHARED
+};
+
+struct iovec32 {
+	uint32_t iov_base;
+	int32_t  iov_len;
+};
+
 template <int W>
 struct State
 {
 	int exit_code = 0;
 	std::string output;
+	// Receives what the guest writes to stdout and stderr, as a list
+	// of buffers that point straight into guest memory, and are only
+	// valid during the call. Large writes are split into several calls
+	// with at most IOV_MAX buffers each. Returns the number of bytes
+	// written, or a negative errno. For example, to stream the output
+	// to the host:
+	//	state.output_sink = [] (int fd, const iovec* vec, size_t count) {
+	//		const ssize_t res = writev(fd, vec, count);
+	//		return (res < 0) ? -errno : (long) res;
+	//	};
+	// Without a sink, the output is collected in @output.
+	using output_sink_t = std::function<long(int fd, const iovec*, size_t count)>;
+	output_sink_t output_sink = nullptr;
+	// brk() and anonymous mmap() areas
+	uint32_t brk_begin = SBRK_START;
+	uint32_t brk_max   = SBRK_MAX;
+	uint32_t sbrk_end  = SBRK_START;
+	MmapArea mmap_area { HEAP_START, HEAP_END };
+	// file mappings with shared pages, by guest address
+	std::map<uint32_t, FileMapping> file_mappings;
+	// Moves the brk() area to [begin, end), before the guest starts.
+	// It should not overlap the mmap() area.
+	void set_brk_area(uint32_t begin, uint32_t end) {
+		brk_begin = sbrk_end = begin;
+		brk_max = end;
+	}
+	// native heap, owned by the machine
+	sas_alloc::Arena* arena = nullptr;
+	// files the guest may read, owned by the machine (see files.hpp)
+	FileTable* files = nullptr;
+	// guest threads, owned by the machine (see threads.hpp)
+	multithreading<W>* threads = nullptr;
+	// guest address of the system call ring, if any
+	riscv::address_type<W> ring_addr = 0;
+	bool ring_busy = false;
 
-	long syscall_exit(riscv::Machine<W>&);
-	long syscall_write(riscv::Machine<W>&);
-	long syscall_writev(riscv::Machine<W>&);
+	long syscall_exit(riscv::Machine<W>&, int status);
+	long syscall_write(riscv::Machine<W>&, int fd, riscv::address_type<W> addr, size_t len);
+	long syscall_writev(riscv::Machine<W>&, int fd, riscv::GuestSpan<const iovec32>);
+	long write_output(int fd, const std::vector<iovec>&);
+	long syscall_ring_setup(riscv::Machine<W>&, riscv::address_type<W> addr);
+	long syscall_ring_enter(riscv::Machine<W>&);
 };
 
+// The State of a machine, which system call handlers find through
+// the userdata of the machine
+template <int W>
+inline State<W>& state_of(riscv::Machine<W>& machine)
+{
+	return *machine.template get_userdata<State<W>> ();
+}
+
+// Installs the system calls directly into a machine, which
+// then uses @state as its userdata
 template <int W>
 void setup_minimal_syscalls(State<W>&, riscv::Machine<W>&);
 
@@ -29,5 +110,24 @@ void setup_newlib_syscalls(State<W>&, riscv::Machine<W>&);
 template <int W>
 void setup_linux_syscalls(State<W>&, riscv::Machine<W>&);
 
+// Installs the same system calls into a table that can be frozen and
+// shared. Machines using it must have their State set as userdata.
+template <int W>
+void setup_minimal_syscalls(riscv::SyscallTable<W>&);
+
+template <int W>
+void setup_newlib_syscalls(riscv::SyscallTable<W>&);
+
+template <int W>
+void setup_linux_syscalls(riscv::SyscallTable<W>&);
+
 template <int W>
 void setup_native_heap_syscalls(State<W>&, riscv::Machine<W>&, size_t);
+
+// Lets the Linux system calls open and read the files under @directory
+template <int W>
+void setup_sandboxed_files(State<W>&, riscv::Machine<W>&, const std::string& directory);
+
+// memcpy, memset, memmove, memcmp, strlen and strcmp done on the host
+template <int W>
+void setup_native_memory_syscalls(riscv::Machine<W>&);
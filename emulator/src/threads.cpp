@@ -1,5 +1,7 @@
 #include "threads.hpp"
+#include <algorithm>
 #include <cassert>
+#include <climits>
 #include <cstdio>
 #include <sched.h>
 using namespace riscv;
@@ -9,6 +11,18 @@ thread<W>::thread(multithreading<W>& mt, int ttid, thread* p,
 				address_t tls, address_t stack)
 	: threading(mt), parent(p), tid(ttid), my_tls(tls), my_stack(stack)   {}
 
+template <int W>
+void thread<W>::init(thread* p, address_t tls, address_t stack)
+{
+	this->parent   = p;
+	this->my_tls   = tls;
+	this->my_stack = stack;
+	this->has_fp   = false;
+	this->clear_tid = 0;
+	this->blocked  = false;
+	this->dead     = false;
+}
+
 template <int W>
 void thread<W>::activate()
 {
@@ -16,12 +30,29 @@ void thread<W>::activate()
 	auto& cpu = threading.machine.cpu;
 	cpu.reg(RISCV::REG_SP) = this->my_stack;
 	cpu.reg(RISCV::REG_TP) = this->my_tls;
+	// every thread starts with a whole time slice
+	threading.machine.reset_timer();
+}
+
+template <int W>
+void thread<W>::save_registers()
+{
+	auto& regs = threading.machine.cpu.registers();
+	regs.save(this->stored_regs);
+	// the FP registers are saved only if they were used since we
+	// were resumed, and otherwise still belong to the FP owner
+	if (regs.fp_used()) {
+		regs.save(this->stored_fp);
+		regs.clear_fp_used();
+		this->has_fp = true;
+		threading.fp_owner = this;
+	}
 }
 
 template <int W>
 void thread<W>::suspend()
 {
-	this->stored_regs = threading.machine.cpu.registers();
+	this->save_registers();
 	// add to suspended (NB: can throw)
 	threading.suspended.push_back(this);
 }
@@ -38,11 +69,18 @@ void thread<W>::exit()
 		THPRINT("Clearing thread value for tid=%d at 0x%X\n",
 				this->tid, this->clear_tid);
 		threading.machine.memory.template write<uint32_t> (this->clear_tid, 0);
+		// wake up whoever is joining this thread
+		threading.wake(this->clear_tid, INT_MAX);
+	}
+	if (exiting_myself) {
+		// the FP registers may have been changed by us
+		auto& regs = thr.machine.cpu.registers();
+		if (regs.fp_used()) thr.fp_owner = nullptr;
+		regs.clear_fp_used();
 	}
-	// delete this thread
+	if (thr.fp_owner == this) thr.fp_owner = nullptr;
+	// the thread object is kept for reuse
 	threading.erase_thread(this->tid);
-	// free thread resources
-	delete this;
 
 	if (exiting_myself)
 	{
@@ -58,12 +96,15 @@ void thread<W>::resume()
 			this->tid, (void*) this->my_tls, (void*) this->my_stack);
 
 	threading.m_current = this;
-	auto& m = threading.machine;
-	// preserve some registers
-	auto counter = m.cpu.registers().counter;
-	// restore registers
-	m.cpu.registers() = this->stored_regs;
-	m.cpu.registers().counter = counter;
+	auto& regs = threading.machine.cpu.registers();
+	regs.restore(this->stored_regs);
+	// the FP registers are only loaded when someone else's are there
+	if (this->has_fp && threading.fp_owner != this) {
+		regs.restore(this->stored_fp);
+		threading.fp_owner = this;
+	}
+	regs.clear_fp_used();
+	threading.machine.reset_timer();
 }
 
 template <int W>
@@ -71,8 +112,18 @@ thread<W>* multithreading<W>::create(
 			thread_t* parent, int flags, address_t ctid, address_t ptid,
 			address_t stack, address_t tls)
 {
-	const int tid = ++thread_counter;
-	auto* thread = new thread_t(*this, tid, parent, tls, stack);
+	thread_t* thread;
+	if (!free_tids.empty()) {
+		thread = threads[free_tids.back()].get();
+		free_tids.pop_back();
+		thread->init(parent, tls, stack);
+	} else {
+		// tid 0 is the main thread
+		if (threads.empty()) threads.emplace_back(nullptr);
+		const int tid = threads.size();
+		threads.push_back(std::make_unique<thread_t>(*this, tid, parent, tls, stack));
+		thread = threads.back().get();
+	}
 
 	// flag for write child TID
 	if (flags & CLONE_CHILD_SETTID) {
@@ -84,11 +135,6 @@ thread<W>* multithreading<W>::create(
 	if (flags & CLONE_CHILD_CLEARTID) {
 		thread->clear_tid = ctid;
 	}
-
-	threads.emplace(
-		std::piecewise_construct,
-		std::forward_as_tuple(tid),
-		std::forward_as_tuple(thread));
 	return thread;
 }
 
@@ -98,6 +144,7 @@ multithreading<W>::multithreading(Machine<W>& mach)
 {
 	main_thread.my_stack = machine.cpu.reg(RISCV::REG_SP);
 	m_current = &main_thread;
+	fp_owner  = &main_thread;
 }
 
 template <int W>
@@ -109,9 +156,9 @@ thread<W>* multithreading<W>::get_thread()
 template <int W>
 thread<W>* multithreading<W>::get_thread(int tid)
 {
-	auto it = threads.find(tid);
-	if (it == threads.end()) return nullptr;
-	return it->second;
+	if (tid <= 0 || tid >= (int) threads.size()) return nullptr;
+	auto* thread = threads[tid].get();
+	return (thread->dead) ? nullptr : thread;
 }
 
 template <int W>
@@ -133,6 +180,20 @@ bool multithreading<W>::suspend_and_yield()
 	return true;
 }
 
+template <int W>
+void multithreading<W>::preempt()
+{
+	if (suspended.empty()) return;
+	THPRINT(">>> Preempting tid=%d\n", get_thread()->tid);
+	// Threads are resumed as if returning from a system call, which
+	// steps over the ECALL, so pretend that we are making one.
+	auto& regs = machine.cpu.registers();
+	regs.pc -= 4;
+	get_thread()->suspend();
+	this->wakeup_next();
+	regs.pc += 4;
+}
+
 template <int W>
 void multithreading<W>::yield_to(int tid)
 {
@@ -142,6 +203,11 @@ void multithreading<W>::yield_to(int tid)
 		machine.cpu.reg(RISCV::REG_ARG0) = -1;
 		return;
 	}
+	// a blocked thread has to be woken up first
+	if (next->blocked) {
+		machine.cpu.reg(RISCV::REG_ARG0) = -1;
+		return;
+	}
 	// return value for yield_to
 	machine.cpu.reg(RISCV::REG_ARG0) = 0;
 	if (thread == next) return;
@@ -161,31 +227,87 @@ void multithreading<W>::yield_to(int tid)
 template <int W>
 void multithreading<W>::wakeup_next()
 {
-  // resume a waiting thread
-  assert(!suspended.empty());
-  auto* next = suspended.front();
-  suspended.pop_front();
-  // resume next thread
-  next->resume();
+	if (UNLIKELY(suspended.empty())) {
+		// the remaining threads are all blocked, so nothing can run
+		m_current = &main_thread;
+		machine.cpu.trigger_exception(DEADLOCK_REACHED);
+		return;
+	}
+	// resume a waiting thread
+	auto* next = suspended.front();
+	suspended.pop_front();
+	// resume next thread
+	next->resume();
 }
 
 template <int W>
 void multithreading<W>::erase_thread(int tid)
 {
-	auto it = threads.find(tid);
-	assert(it != threads.end());
-	threads.erase(it);
+	auto* thread = get_thread(tid);
+	assert(thread != nullptr);
+	// an exiting thread can be waiting for its turn, or blocked
+	auto& queue = (thread->blocked)
+		? futex_waiters[thread->futex_addr] : suspended;
+	auto qit = std::find(queue.begin(), queue.end(), thread);
+	if (qit != queue.end()) queue.erase(qit);
+	if (thread->blocked && queue.empty())
+		futex_waiters.erase(thread->futex_addr);
+	thread->blocked = false;
+	thread->dead = true;
+	free_tids.push_back(tid);
 }
 
 template <int W>
-void setup_multithreading(State<W>& state, Machine<W>& machine)
+bool multithreading<W>::block(address_t addr)
 {
-	auto* mt = new multithreading<W>(machine);
-	machine.add_destructor_callback([mt] { delete mt; });
+	// with nobody else to run, nobody can wake us up
+	if (suspended.empty()) return false;
+	auto* thread = get_thread();
+	thread->save_registers();
+	// the return value for FUTEX_WAIT, once woken up
+	thread->stored_regs.get(RISCV::REG_ARG0) = 0;
+	thread->blocked = true;
+	thread->futex_addr = addr;
+	futex_waiters[addr].push_back(thread);
+	this->wakeup_next();
+	return true;
+}
+
+template <int W>
+int multithreading<W>::wake(address_t addr, int count)
+{
+	auto it = futex_waiters.find(addr);
+	if (it == futex_waiters.end()) return 0;
+	auto& queue = it->second;
+	int woken = 0;
+	// the woken threads run after those already waiting to run
+	while (woken < count && !queue.empty()) {
+		auto* thread = queue.front();
+		queue.pop_front();
+		thread->blocked = false;
+		suspended.push_back(thread);
+		woken++;
+	}
+	if (queue.empty()) futex_waiters.erase(it);
+	return woken;
+}
+
+// The threads of the calling machine, see attach_multithreading()
+template <int W>
+static multithreading<W>& threads_of(Machine<W>& machine)
+{
+	return *state_of(machine).threads;
+}
 
+// Handlers are installed into either a machine or a shared table,
+// and find the threads through the State of the calling machine.
+template <int W, typename Target>
+static void add_multithreading_syscalls(Target& machine)
+{
 	// exit & exit_group
 	machine.install_syscall_handler(93,
-	[mt, &state] (Machine<W>& machine) {
+	[] (Machine<W>& machine) {
+		auto* mt = &threads_of(machine);
 		const uint32_t status = machine.template sysarg<uint32_t> (0);
 		const int tid = mt->get_thread()->tid;
 		THPRINT(">>> Exit on tid=%ld, exit code = %d\n",
@@ -197,7 +319,7 @@ void setup_multithreading(State<W>& state, Machine<W>& machine)
 			assert(mt->get_thread()->tid != tid);
 			return machine.cpu.reg(RISCV::REG_ARG0);
 		}
-		state.exit_code = status;
+		state_of(machine).exit_code = status;
 		machine.stop();
 		return status;
 	});
@@ -205,7 +327,8 @@ void setup_multithreading(State<W>& state, Machine<W>& machine)
 	machine.install_syscall_handler(94, machine.get_syscall_handler(93));
 	// set_tid_address
 	machine.install_syscall_handler(96,
-	[mt] (Machine<W>& machine) {
+	[] (Machine<W>& machine) {
+		auto* mt = &threads_of(machine);
 		const int clear_tid = machine.template sysarg<address_type<W>> (0);
 		THPRINT(">>> set_tid_address(0x%X)\n", clear_tid);
 
@@ -219,7 +342,8 @@ void setup_multithreading(State<W>& state, Machine<W>& machine)
 	});
 	// sched_yield
 	machine.install_syscall_handler(124,
-	[mt] (Machine<W>& machine) {
+	[] (Machine<W>& machine) {
+		auto* mt = &threads_of(machine);
 		THPRINT(">>> sched_yield()\n");
 		// begone!
 		mt->suspend_and_yield();
@@ -228,7 +352,8 @@ void setup_multithreading(State<W>& state, Machine<W>& machine)
 	});
 	// tgkill
 	machine.install_syscall_handler(131,
-	[mt] (Machine<W>& machine) {
+	[] (Machine<W>& machine) {
+		auto* mt = &threads_of(machine);
 		const int tid = machine.template sysarg<int> (1);
 		THPRINT(">>> tgkill on tid=%d\n", tid);
 		auto* thread = mt->get_thread(tid);
@@ -243,13 +368,15 @@ void setup_multithreading(State<W>& state, Machine<W>& machine)
 	});
 	// gettid
 	machine.install_syscall_handler(178,
-	[mt] (Machine<W>&) {
+	[] (Machine<W>& machine) {
+		auto* mt = &threads_of(machine);
 		THPRINT(">>> gettid() = %ld\n", mt->get_thread()->tid);
 		return mt->get_thread()->tid;
 	});
 	// futex
 	machine.install_syscall_handler(98,
-	[mt] (Machine<W>& machine) {
+	[] (Machine<W>& machine) {
+		auto* mt = &threads_of(machine);
 		#define FUTEX_WAIT 0
 		#define FUTEX_WAKE 1
 		const uint32_t addr = machine.template sysarg<uint32_t> (0);
@@ -259,25 +386,24 @@ void setup_multithreading(State<W>& state, Machine<W>& machine)
 		if ((futex_op & 0xF) == FUTEX_WAIT)
 	    {
 			THPRINT("FUTEX: Waiting for unlock... uaddr=0x%X val=%d\n", addr, val);
-			while (machine.memory.template read<uint32_t> (addr) == val) {
-				if (mt->suspend_and_yield()) {
-					return (int) machine.cpu.reg(RISCV::REG_ARG0);
-				}
-				machine.cpu.trigger_exception(DEADLOCK_REACHED);
-			}
-			return 0;
-		} else if ((futex_op & 0xF) == FUTEX_WAKE) {
-			THPRINT("FUTEX: Waking others on %d\n", val);
-			if (mt->suspend_and_yield()) {
+			if (machine.memory.template read<uint32_t> (addr) != (uint32_t) val)
+				return -EAGAIN;
+			if (mt->block(addr)) {
+				// preserve A0 for the new thread
 				return (int) machine.cpu.reg(RISCV::REG_ARG0);
 			}
-			return 0;
+			machine.cpu.trigger_exception(DEADLOCK_REACHED, addr);
+			return -EDEADLK;
+		} else if ((futex_op & 0xF) == FUTEX_WAKE) {
+			THPRINT("FUTEX: Waking %d others on 0x%X\n", val, addr);
+			return mt->wake(addr, val);
 		}
 		return -ENOSYS;
 	});
 	// clone
 	machine.install_syscall_handler(220,
-	[mt] (Machine<W>& machine) {
+	[] (Machine<W>& machine) {
+		auto* mt = &threads_of(machine);
 		/* int clone(int (*fn)(void *arg), void *child_stack, int flags, void *arg,
 		             void *parent_tidptr, void *tls, void *child_tidptr) */
 		const int      flags = machine.template sysarg<int> (0);
@@ -303,5 +429,33 @@ void setup_multithreading(State<W>& state, Machine<W>& machine)
 	});
 }
 
+template <int W>
+void attach_multithreading(State<W>& state, Machine<W>& machine)
+{
+	auto* mt = new multithreading<W>(machine);
+	machine.add_destructor_callback([mt] { delete mt; });
+	state.threads = mt;
+	machine.set_userdata(&state);
+	// busy threads give way to the others when their time is up
+	machine.set_timer(multithreading<W>::TIME_SLICE,
+		[mt] (Machine<W>&) { mt->preempt(); });
+}
+
+template <int W>
+void setup_multithreading(State<W>& state, Machine<W>& machine)
+{
+	attach_multithreading(state, machine);
+	add_multithreading_syscalls<W>(machine);
+}
+template <int W>
+void setup_multithreading(SyscallTable<W>& table)
+{
+	add_multithreading_syscalls<W>(table);
+}
+
+template
+void attach_multithreading<4>(State<4>&, Machine<4>& machine);
 template
 void setup_multithreading<4>(State<4>&, Machine<4>& machine);
+template
+void setup_multithreading<4>(SyscallTable<4>&);
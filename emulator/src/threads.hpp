@@ -1,6 +1,8 @@
 #pragma once
 #include <deque>
 #include <map>
+#include <memory>
+#include <vector>
 #include <libriscv/machine.hpp>
 #include "syscalls.hpp"
 template <int W> struct multithreading;
@@ -23,14 +25,25 @@ struct thread
 	address_t my_tls;
 	address_t my_stack;
 	// for returning to this thread
-	riscv::Registers<W> stored_regs;
+	typename riscv::Registers<W>::IntegerFile stored_regs;
+	// the FP registers, once this thread has used them
+	typename riscv::Registers<W>::FloatFile stored_fp;
+	bool      has_fp = false;
 	// address zeroed when exiting
 	address_t clear_tid = 0;
+	// waiting in a futex queue, and not runnable
+	bool      blocked = false;
+	address_t futex_addr = 0;
+	// exited, with the object and tid waiting to be reused
+	bool      dead = false;
 
 	thread(multithreading<W>&, int tid, thread* parent,
 			address_t tls, address_t stack);
+	void init(thread* parent, address_t tls, address_t stack);
 	void exit();
+	// save_registers() + put in the run queue
 	void suspend();
+	void save_registers();
 	void activate();
 	void resume();
 };
@@ -40,26 +53,54 @@ struct multithreading
 {
 	using address_t = riscv::address_type<W>;
 	using thread_t  = thread<W>;
+	// instructions a thread gets to run before it is preempted
+	static constexpr uint64_t TIME_SLICE = 1'000'000;
 
 	thread_t* create(thread_t* parent, int flags, address_t ctid, address_t ptid,
 					address_t stack, address_t tls);
 	thread_t* get_thread();
 	thread_t* get_thread(int tid); /* or nullptr */
 	bool      suspend_and_yield();
+	// switch to the next runnable thread outside of a system call
+	void      preempt();
 	void      yield_to(int tid);
 	void      erase_thread(int tid);
 	void      wakeup_next();
+	// futex: block the current thread on @addr and run another,
+	// or wake up to @count threads blocked on @addr
+	bool      block(address_t addr);
+	int       wake(address_t addr, int count);
 
 	multithreading(riscv::Machine<W>&);
 	riscv::Machine<W>& machine;
+	// runnable threads, in the order they get to run
 	std::deque<thread_t*> suspended;
-	std::map<int, thread_t*> threads;
-	int        thread_counter = 0;
+	// blocked threads, by the futex they wait on
+	std::map<address_t, std::deque<thread_t*>> futex_waiters;
+	// every thread by tid (except the main thread), and the tids of
+	// exited threads, whose thread objects are reused first
+	std::vector<std::unique_ptr<thread_t>> threads;
+	std::vector<int> free_tids;
 	thread_t*  m_current = nullptr;
+	// the thread the FP registers in the CPU belong to, if any
+	thread_t*  fp_owner = nullptr;
 	thread_t   main_thread;
 };
 
+// Installs the threading system calls directly into a machine,
+// which then uses @state as its userdata
 template <int W>
 void setup_multithreading(State<W>&, riscv::Machine<W>&);
+// Installs the same system calls into a table that can be frozen and
+// shared. Each machine using it needs attach_multithreading() as well.
+template <int W>
+void setup_multithreading(riscv::SyscallTable<W>&);
+// Gives a machine the threads (and the timer that preempts them) the
+// threading system calls work on, without installing any handlers
+template <int W>
+void attach_multithreading(State<W>&, riscv::Machine<W>&);
 template <int W>
 void setup_native_threads(State<W>&, riscv::Machine<W>&);
+// Runs every guest thread in parallel on its own host thread
+template <int W>
+void setup_parallel_threads(State<W>&, riscv::Machine<W>&);
@@ -6,8 +6,9 @@ extern "C"
 void LLVMFuzzerTestOneInput(const uint8_t* data, size_t len)
 {
 	static riscv::Machine<riscv::RISCV32> machine { };
-	// we don't want to see unhandled syscall messages
-	riscv::verbose_machine = false;
+	// stop on CPU exceptions instead of throwing them
+	machine.cpu.set_fault_handler(
+		[] (auto&, int, uint32_t) { return false; });
 
 	// copy fuzzer data to 0x1000 and skip the zero-page
 	machine.copy_to_guest(0x1000, data, len);
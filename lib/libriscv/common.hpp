@@ -25,9 +25,8 @@
 namespace riscv
 {
 	static constexpr int SYSCALL_EBREAK = SYSCALL_EBREAK_NR;
-
-	// print information during machine creation
-	extern bool verbose_machine;
+	// number of system call handler slots
+	static constexpr int SYSCALLS_MAX = 512;
 
 #ifdef MEMORY_TRAPS_ENABLED
 	static constexpr bool memory_traps_enabled = true;
@@ -0,0 +1,206 @@
+#pragma once
+#if __cplusplus < 202002L || !__has_include(<coroutine>)
+#error "libriscv/coroutine.hpp requires C++20 coroutines"
+#endif
+#include "machine.hpp"
+#include <algorithm>
+#include <cassert>
+#include <coroutine>
+#include <exception>
+#include <optional>
+
+namespace riscv
+{
+	// Lets coroutines run machines, and lets system call handlers block
+	// a guest on host events without blocking the host thread:
+	//
+	//	CoTask<int> serve(CoMachine<RISCV32>& vm) {
+	//		co_return co_await vm.run();
+	//	}
+	//	machine.install_syscall_handler(63, [&vm] (auto& machine) -> long {
+	//		start_async_read(..., [&vm] (long result) { vm.wake(result); });
+	//		vm.block();
+	//		return 0;
+	//	});
+	//
+	// A blocked guest stops executing, and the coroutine awaiting it is
+	// suspended. When the host event completes, wake() delivers the
+	// return value of the system call and continues running the guest
+	// on the calling thread. Once the guest stops for real, the awaiting
+	// coroutine resumes.
+	template <int W>
+	struct CoMachine
+	{
+		using address_t = address_type<W>;
+
+		// Run the machine until it stops, or until it has executed
+		// @max_instructions (0 is no limit). Gives the simulate() status.
+		auto run(uint64_t max_instructions = 0);
+
+		// Call a guest function, giving its return value (A0)
+		template <typename... Args>
+		auto vmcall(address_t call_addr, Args&&... args);
+		template <typename... Args>
+		auto vmcall(const char* funcname, Args&&... args);
+
+		// From inside a system call handler: stop the guest, and
+		// suspend whoever awaits it until wake() is called.
+		void block();
+		bool blocked() const noexcept { return m_blocked; }
+		// Finish the blocking system call with @retval and continue
+		void wake(address_t retval);
+
+		// True when the instruction budget ran out
+		bool timed_out() const noexcept { return m_limited && m_budget == 0; }
+
+		Machine<W>& machine() noexcept { return m_machine; }
+
+		CoMachine(Machine<W>& m) : m_machine(m) {}
+
+	private:
+		template <bool CALL> struct Awaiter;
+		bool step();
+
+		Machine<W>& m_machine;
+		std::coroutine_handle<> m_waiter = nullptr;
+		uint64_t m_budget  = 0;
+		bool     m_limited = false;
+		bool     m_blocked = false;
+		int      m_status  = 0;
+	};
+
+	template <int W>
+	template <bool CALL>
+	struct CoMachine<W>::Awaiter
+	{
+		CoMachine& vm;
+		address_t  sp; // restored after a vmcall
+
+		bool await_ready() { return vm.step(); }
+		void await_suspend(std::coroutine_handle<> h) {
+			assert(vm.m_waiter == nullptr && "Only one coroutine can await a machine");
+			vm.m_waiter = h;
+		}
+		auto await_resume() {
+			if constexpr (CALL) {
+				vm.m_machine.cpu.reg(RISCV::REG_SP) = sp;
+				return vm.m_machine.cpu.reg(RISCV::REG_ARG0);
+			} else {
+				return vm.m_status;
+			}
+		}
+	};
+
+	// Returns true when the machine is done, and false if it blocked
+	template <int W>
+	inline bool CoMachine<W>::step()
+	{
+		m_blocked = false;
+		if (m_limited) {
+			if (m_budget == 0) return true;
+			const uint64_t counter = m_machine.cpu.instruction_counter();
+			m_status = m_machine.simulate(m_budget);
+			const uint64_t executed = m_machine.cpu.instruction_counter() - counter;
+			m_budget -= std::min(m_budget, executed);
+		} else {
+			m_status = m_machine.simulate();
+		}
+		return !m_blocked;
+	}
+
+	template <int W>
+	inline auto CoMachine<W>::run(uint64_t max_instructions)
+	{
+		m_budget  = max_instructions;
+		m_limited = (max_instructions != 0);
+		return Awaiter<false> { *this, 0 };
+	}
+
+	template <int W>
+	template <typename... Args>
+	inline auto CoMachine<W>::vmcall(address_t call_addr, Args&&... args)
+	{
+		const address_t sp = m_machine.cpu.reg(RISCV::REG_SP);
+		m_machine.setup_call(call_addr, std::forward<Args>(args)...);
+		m_budget  = 0;
+		m_limited = false;
+		return Awaiter<true> { *this, sp };
+	}
+	template <int W>
+	template <typename... Args>
+	inline auto CoMachine<W>::vmcall(const char* funcname, Args&&... args)
+	{
+		const address_t call_addr = m_machine.memory.resolve_address(funcname);
+		return vmcall(call_addr, std::forward<Args>(args)...);
+	}
+
+	template <int W>
+	inline void CoMachine<W>::block()
+	{
+		m_blocked = true;
+		m_machine.stop();
+	}
+
+	template <int W>
+	inline void CoMachine<W>::wake(address_t retval)
+	{
+		assert(m_blocked && "The machine is not blocked");
+		m_machine.cpu.reg(RISCV::REG_RETVAL) = retval;
+		if (this->step() && m_waiter != nullptr) {
+			auto waiter = m_waiter;
+			m_waiter = nullptr;
+			waiter.resume();
+		}
+	}
+
+	// A minimal eagerly started coroutine type. The result is available
+	// from get() when done(), and other coroutines can co_await it.
+	template <typename T>
+	struct CoTask
+	{
+		struct promise_type {
+			std::optional<T>        value;
+			std::exception_ptr      exception;
+			std::coroutine_handle<> continuation = nullptr;
+
+			CoTask get_return_object() {
+				return CoTask { std::coroutine_handle<promise_type>::from_promise(*this) };
+			}
+			std::suspend_never initial_suspend() noexcept { return {}; }
+			auto final_suspend() noexcept {
+				struct Final {
+					bool await_ready() noexcept { return false; }
+					std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) noexcept {
+						auto next = h.promise().continuation;
+						return (next) ? next : std::noop_coroutine();
+					}
+					void await_resume() noexcept {}
+				};
+				return Final {};
+			}
+			void return_value(T v) { value = std::move(v); }
+			void unhandled_exception() { exception = std::current_exception(); }
+		};
+
+		bool done() const noexcept { return m_handle.done(); }
+		T& get() {
+			assert(done());
+			if (m_handle.promise().exception)
+				std::rethrow_exception(m_handle.promise().exception);
+			return *m_handle.promise().value;
+		}
+
+		bool await_ready() const noexcept { return done(); }
+		void await_suspend(std::coroutine_handle<> h) noexcept {
+			m_handle.promise().continuation = h;
+		}
+		T& await_resume() { return get(); }
+
+		CoTask(CoTask&& other) noexcept : m_handle(other.m_handle) { other.m_handle = nullptr; }
+		CoTask(const CoTask&) = delete;
+		~CoTask() { if (m_handle) m_handle.destroy(); }
+	private:
+		explicit CoTask(std::coroutine_handle<promise_type> h) : m_handle(h) {}
+		std::coroutine_handle<promise_type> m_handle;
+	};
+}
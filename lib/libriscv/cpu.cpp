@@ -23,13 +23,13 @@ namespace riscv
 	}
 
 	template <int W>
-	typename CPU<W>::format_t CPU<W>::read_instruction(address_t address)
+	bool CPU<W>::read_instruction(address_t address, format_t& instruction)
 	{
-		format_t instruction;
 #ifndef RISCV_DEBUG
 		const address_t this_page = address & ~(Page::size()-1);
 		if (this_page != this->m_current_page.address) {
-			this->change_page(this_page);
+			if (UNLIKELY(!this->change_page(this_page)))
+				return false;
 #ifdef RISCV_INSTR_CACHE
 			if (UNLIKELY(m_current_page.page->decoder_cache() == nullptr)) {
 				m_current_page.page->template create_decoder_cache<DecoderCache>();
@@ -53,7 +53,7 @@ namespace riscv
 				// we can read the whole thing
 				instruction.whole =
 					m_current_page.page->template aligned_read<uint32_t> (offset);
-				return instruction;
+				return true;
 			}
 
 			// read short instruction at address
@@ -63,7 +63,8 @@ namespace riscv
 			// read upper half, completing a 32-bit instruction
 			if (instruction.is_long()) {
 				// this instruction crosses a page-border
-				this->change_page(m_current_page.address + Page::size());
+				if (UNLIKELY(!this->change_page(m_current_page.address + Page::size())))
+					return false;
 				instruction.half[1] =
 					m_current_page.page->template aligned_read<uint16_t>(0);
 			}
@@ -85,8 +86,11 @@ namespace riscv
 					this->machine().memory.template read<uint16_t>(address + 2);
 			}
 		}
+		// a fault handler stopped the machine while reading
+		if (UNLIKELY(m_fault.type >= 0))
+			return false;
 #endif
-		return instruction;
+		return true;
 	}
 
 	template<int W>
@@ -95,7 +99,9 @@ namespace riscv
 #ifdef RISCV_DEBUG
 		this->break_checks();
 #endif
-		const auto instruction = this->read_instruction(this->pc());
+		format_t instruction;
+		if (UNLIKELY(!this->read_instruction(this->pc(), instruction)))
+			return;
 
 #ifdef RISCV_DEBUG
 		const auto& handler = this->decode(instruction);
@@ -117,7 +123,7 @@ namespace riscv
 		auto& ihandler = dcache->cache32[offset / DecoderCache::DIVISOR];
 		// decode and store into cache, if necessary
 		if (UNLIKELY(!ihandler)) {
-			ihandler = this->decode(instruction).handler;
+			ihandler = this->decode_for_cache(instruction, this->pc());
 		}
 		// execute instruction
 		ihandler(*this, instruction);
@@ -153,30 +159,52 @@ namespace riscv
 	}
 
 	template<int W>
-	void CPU<W>::trigger_exception(interrupt_t intr)
+	bool CPU<W>::trigger_exception(interrupt_t intr, address_t data)
 	{
-		// TODO: replace with callback system
+		m_faults++;
+		if (m_fault_handler != nullptr)
+		{
+			const bool resume = m_fault_handler(*this, intr, data);
+			if (!resume) {
+				// the fault is reported from Machine::simulate()
+				m_fault = { intr, this->pc(), data };
+				m_fault_reported = false;
+				machine().stop();
+			}
+			// the instruction is run again, unless the machine stopped
+			if (m_simulating) throw InstructionAborted {};
+			return resume;
+		}
 		switch (intr)
 		{
 		case ILLEGAL_OPCODE:
 			throw MachineException(ILLEGAL_OPCODE,
-									"Illegal opcode executed");
+									"Illegal opcode executed", data);
 		case ILLEGAL_OPERATION:
 			throw MachineException(ILLEGAL_OPERATION,
-									"Illegal operation during instruction decoding");
+									"Illegal operation during instruction decoding", data);
 		case PROTECTION_FAULT:
 			throw MachineException(PROTECTION_FAULT,
-									"Protection fault");
+									"Protection fault", data);
 		case EXECUTION_SPACE_PROTECTION_FAULT:
 			throw MachineException(EXECUTION_SPACE_PROTECTION_FAULT,
-									"Execution space protection fault");
+									"Execution space protection fault", data);
 		case MISALIGNED_INSTRUCTION:
 			// NOTE: only check for this when jumping or branching
 			throw MachineException(MISALIGNED_INSTRUCTION,
-									"Misaligned instruction executed");
+									"Misaligned instruction executed", data);
 		case UNIMPLEMENTED_INSTRUCTION:
 			throw MachineException(UNIMPLEMENTED_INSTRUCTION,
-									"Unimplemented instruction executed");
+									"Unimplemented instruction executed", data);
+		case UNHANDLED_SYSCALL:
+			throw MachineException(UNHANDLED_SYSCALL,
+									"Unhandled system call", data);
+		case INVALID_ALIGNMENT:
+			throw MachineException(INVALID_ALIGNMENT,
+									"Misaligned atomic memory access", data);
+		case DEADLOCK_REACHED:
+			throw MachineException(DEADLOCK_REACHED,
+									"Deadlock reached", data);
 		default:
 			throw MachineException(UNKNOWN_EXCEPTION, "Unknown exception", intr);
 		}
@@ -22,6 +22,13 @@ namespace riscv
 		using format_t  = typename isa_t::format_t; // one machine instruction
 		using breakpoint_t = delegate<void(CPU<W>&)>; // machine instruction
 		using instruction_t = Instruction<W>;
+		// return true to resume execution, false to stop the machine
+		using fault_handler_t = delegate<bool(CPU<W>&, int type, address_t data)>;
+		struct Fault {
+			int       type = -1; // exception type, or -1 for no fault
+			address_t pc   = 0;
+			address_t data = 0;
+		};
 
 		void simulate();
 		void reset();
@@ -46,7 +53,22 @@ namespace riscv
 		auto& atomics() noexcept { return this->m_atomics; }
 		const auto& atomics() const noexcept { return this->m_atomics; }
 
-		static void trigger_exception(interrupt_t) COLD_PATH();
+		// Without a fault handler exceptions are thrown as MachineException.
+		// With one, the handler decides: It can resolve the fault and return
+		// true, after which the faulting instruction is run again, or it can
+		// return false, which stops the machine and records the fault. The
+		// faulting instruction is abandoned either way, without writing any
+		// registers, and the pc stays on it. A system call is run again
+		// from the start. Faults raised by host code outside of simulate()
+		// return instead: true only when execution was resumed.
+		bool trigger_exception(interrupt_t, address_t data = 0) COLD_PATH();
+		void set_fault_handler(fault_handler_t h) { m_fault_handler = h; }
+		// The last fault that stopped the machine, until it has been
+		// reported by Machine::simulate()
+		const Fault& fault() const noexcept { return m_fault; }
+		// number of exceptions triggered so far
+		uint64_t faults() const noexcept { return m_faults; }
+		void clear_fault() noexcept { m_fault = {}; }
 
 #ifdef RISCV_DEBUG
 		// debugging
@@ -57,17 +79,28 @@ namespace riscv
 		static void default_pausepoint(CPU&);
 #endif
 		const instruction_t& decode(format_t) const;
+#ifdef RISCV_INSTR_CACHE
+		// decode an instruction at @pc for the instruction cache,
+		// which may pick a handler specialized for its surroundings
+		typename instruction_t::handler_t decode_for_cache(format_t, address_t pc) const;
+#endif
 
 		// serializes all the machine state + a tiny header to @vec
 		void serialize_to(std::vector<uint8_t>& vec);
 		// returns the machine to a previously stored state
 		void deserialize_from(const std::vector<uint8_t>&, const SerializedMachine<W>&);
+		// see Machine::snapshot()
+		void snapshot();
+		void restore_snapshot();
+		// forget the pages cached for instruction fetching, which
+		// must be done when pages have been erased or replaced
+		void invalidate_page_cache() noexcept;
 
 		CPU(Machine<W>&);
 	private:
 		Registers<W> m_regs;
 
-		inline format_t read_instruction(address_t);
+		inline bool read_instruction(address_t, format_t&);
 		void execute(format_t);
 
 		Machine<W>& m_machine;
@@ -80,7 +113,7 @@ namespace riscv
 		std::array<CachedPage, RISCV_PAGE_CACHE> m_page_cache = {};
 		size_t m_cache_iterator = 0;
 #endif
-		inline void change_page(address_t address);
+		inline bool change_page(address_t address);
 
 #ifdef RISCV_DEBUG
 		// instruction step & breakpoints
@@ -88,9 +121,18 @@ namespace riscv
 	    mutable int32_t m_break_steps_cnt = 0;
 	    std::map<address_t, breakpoint_t> m_breakpoints;
 		bool break_time() const;
-		friend struct Machine<W>;
 #endif
+		friend struct Machine<W>;
+		// thrown to abandon the instruction that faulted, which is
+		// caught by Machine::simulate()
+		struct InstructionAborted {};
 		AtomicMemory<W> m_atomics;
+		fault_handler_t m_fault_handler = nullptr;
+		Fault m_fault;
+		bool m_fault_reported = false;
+		bool m_simulating = false; // inside Machine::simulate()
+		uint64_t m_faults = 0;
+		Registers<W> m_snapshot_regs;
 		static_assert((W == 4 || W == 8), "Must be either 4-byte or 8-byte ISA");
 	};
 
@@ -6,43 +6,56 @@ inline CPU<W>::CPU(Machine<W>& machine)
 }
 
 template <int W>
-inline void CPU<W>::change_page(address_t this_page)
+inline bool CPU<W>::change_page(address_t this_page)
 {
 #ifdef RISCV_PAGE_CACHE
 	for (const auto& cache : m_page_cache) {
 		if (cache.address == this_page) {
 			m_current_page = cache;
-			return;
+			return true;
 		}
 	}
 #endif
-	m_current_page.address = this_page;
-	m_current_page.page = &machine().memory.create_page(this_page >> Page::SHIFT);
+	auto* page = &machine().memory.create_page_untracked(this_page >> Page::SHIFT);
+	// verify execute permission, before the page is remembered
+	if (UNLIKELY(!page->attr.exec)) {
+		m_current_page = { nullptr, address_t(-1) };
+#ifdef RISCV_PAGE_CACHE
+		for (auto& cache : m_page_cache) {
+			if (cache.address == this_page) cache = m_current_page;
+		}
+#endif
+		// a fault handler may make the page executable and resume
+		if (!this->trigger_exception(EXECUTION_SPACE_PROTECTION_FAULT, this_page))
+			return false;
+		page = &machine().memory.create_page_untracked(this_page >> Page::SHIFT);
+		if (!page->attr.exec)
+			return false;
+	}
+	m_current_page = { page, this_page };
 #ifdef RISCV_PAGE_CACHE
 	// cache it
 	m_page_cache[m_cache_iterator] = m_current_page;
 	m_cache_iterator = (m_cache_iterator + 1) % m_page_cache.size();
 #endif
-	// verify execute permission
-	if (UNLIKELY(!m_current_page.page->attr.exec)) {
-		this->trigger_exception(EXECUTION_SPACE_PROTECTION_FAULT);
-	}
+	return true;
 }
 
 template<int W> constexpr
 inline void CPU<W>::jump(const address_t dst)
 {
-	this->registers().pc = dst;
-	// it's possible to jump to a misaligned address
+	// it's possible to jump to a misaligned address, which faults
+	// while the pc is still on the jump instruction
 	if constexpr (!compressed_enabled) {
-		if (UNLIKELY(this->registers().pc & 0x3)) {
+		if (UNLIKELY(dst & 0x3)) {
 			this->trigger_exception(MISALIGNED_INSTRUCTION);
 		}
 	} else {
-		if (UNLIKELY(this->registers().pc & 0x1)) {
+		if (UNLIKELY(dst & 0x1)) {
 			this->trigger_exception(MISALIGNED_INSTRUCTION);
 		}
 	}
+	this->registers().pc = dst;
 }
 
 #ifdef RISCV_DEBUG
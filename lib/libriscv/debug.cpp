@@ -200,7 +200,8 @@ template<int W>
 void Machine<W>::print_and_pause()
 {
 	try {
-		const auto instruction = cpu.read_instruction(cpu.pc());
+		typename CPU<W>::format_t instruction;
+		cpu.read_instruction(cpu.pc(), instruction);
 		const auto& handler = cpu.decode(instruction);
 		const auto string = CPU<W>::isa_t::to_string(cpu, instruction, handler);
 		printf("\n>>> Breakpoint \t%s\n\n", string.c_str());
@@ -0,0 +1,228 @@
+#pragma once
+#include "machine.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <future>
+#include <mutex>
+#include <thread>
+
+namespace riscv
+{
+	// Runs machines on a pool of worker threads, a time slice at a time.
+	// Each worker has its own queue of machines, and a worker that runs
+	// out of work steals from the others. A machine only ever runs on
+	// one worker at a time, but it can move between workers from one
+	// slice to the next, so it must not be touched until it completes.
+	template <int W>
+	struct Executor
+	{
+		struct Stats {
+			uint64_t instructions = 0;   // executed by the executor
+			uint64_t slices = 0;         // number of time slices
+			std::chrono::nanoseconds cpu_time {0}; // spent simulating
+			unsigned migrations = 0;     // slices stolen by another worker
+		};
+		struct Result {
+			int   status = 0;     // from Machine::simulate()
+			bool  timed_out = false; // ran out of instructions
+			Stats stats;
+		};
+
+		// Submit a machine for execution. It runs until it stops, or
+		// until it has executed @max_instructions (0 is no limit). The
+		// future holds the result, or the exception the machine threw.
+		std::future<Result> submit(Machine<W>&, uint64_t max_instructions = 0);
+
+		// Number of machines queued or running
+		size_t pending() const noexcept { return m_pending.load(); }
+
+		unsigned workers() const noexcept { return m_workers.size(); }
+		uint64_t slice() const noexcept { return m_slice; }
+
+		// @slice is the number of instructions each machine gets
+		// before it has to give way to the next one in the queue
+		Executor(unsigned workers = std::thread::hardware_concurrency(),
+				uint64_t slice = 100'000);
+		// Stops the workers once all submitted machines have completed
+		~Executor();
+		Executor(const Executor&) = delete;
+		Executor& operator= (const Executor&) = delete;
+
+	private:
+		struct Job {
+			Machine<W>* machine;
+			uint64_t    budget; // remaining instructions, or 0 for no limit
+			unsigned    last_worker;
+			Result      result;
+			std::promise<Result> promise;
+		};
+		struct Worker {
+			std::mutex       mtx;
+			std::deque<Job*> queue;
+			std::thread      thread;
+		};
+		void worker_loop(unsigned idx);
+		Job* next_job(unsigned idx);
+		void enqueue(unsigned idx, Job*);
+		bool run_slice(Job&, unsigned idx);
+
+		const uint64_t m_slice;
+		std::vector<std::unique_ptr<Worker>> m_workers;
+		std::atomic<size_t>   m_pending {0};
+		std::atomic<size_t>   m_queued  {0};
+		std::atomic<unsigned> m_next_worker {0};
+		std::mutex              m_idle_mtx;
+		std::condition_variable m_idle_cv;
+		bool m_stopping = false;
+	};
+
+	template <int W>
+	inline Executor<W>::Executor(unsigned workers, uint64_t slice)
+		: m_slice(slice)
+	{
+		if (workers == 0) workers = 1;
+		for (unsigned i = 0; i < workers; i++)
+			m_workers.push_back(std::make_unique<Worker>());
+		// start the threads only after every worker exists
+		for (unsigned i = 0; i < workers; i++)
+			m_workers[i]->thread = std::thread(&Executor::worker_loop, this, i);
+	}
+
+	template <int W>
+	inline Executor<W>::~Executor()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_idle_mtx);
+			m_stopping = true;
+		}
+		m_idle_cv.notify_all();
+		for (auto& worker : m_workers)
+			worker->thread.join();
+	}
+
+	template <int W>
+	inline std::future<typename Executor<W>::Result>
+	Executor<W>::submit(Machine<W>& machine, uint64_t max_instructions)
+	{
+		auto* job = new Job { &machine, max_instructions, 0, {}, {} };
+		auto future = job->promise.get_future();
+		const unsigned idx = m_next_worker++ % m_workers.size();
+		job->last_worker = idx;
+		m_pending++;
+		this->enqueue(idx, job);
+		return future;
+	}
+
+	template <int W>
+	inline void Executor<W>::enqueue(unsigned idx, Job* job)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_workers[idx]->mtx);
+			m_workers[idx]->queue.push_back(job);
+		}
+		{
+			// the idle mutex orders this with workers going to sleep
+			std::lock_guard<std::mutex> lock(m_idle_mtx);
+			m_queued++;
+		}
+		m_idle_cv.notify_one();
+	}
+
+	template <int W>
+	inline typename Executor<W>::Job* Executor<W>::next_job(unsigned idx)
+	{
+		// our own queue first, oldest machine first
+		{
+			auto& self = *m_workers[idx];
+			std::lock_guard<std::mutex> lock(self.mtx);
+			if (!self.queue.empty()) {
+				Job* job = self.queue.front();
+				self.queue.pop_front();
+				m_queued--;
+				return job;
+			}
+		}
+		// steal from the back of someone else's queue
+		for (unsigned i = 1; i < m_workers.size(); i++)
+		{
+			auto& victim = *m_workers[(idx + i) % m_workers.size()];
+			std::lock_guard<std::mutex> lock(victim.mtx);
+			if (!victim.queue.empty()) {
+				Job* job = victim.queue.back();
+				victim.queue.pop_back();
+				m_queued--;
+				return job;
+			}
+		}
+		return nullptr;
+	}
+
+	template <int W>
+	inline void Executor<W>::worker_loop(unsigned idx)
+	{
+		while (true)
+		{
+			Job* job = this->next_job(idx);
+			if (job == nullptr) {
+				std::unique_lock<std::mutex> lock(m_idle_mtx);
+				m_idle_cv.wait(lock, [this] {
+					return m_queued > 0 || (m_stopping && m_pending == 0);
+				});
+				if (m_queued == 0 && m_stopping && m_pending == 0) return;
+				continue;
+			}
+			try {
+				if (this->run_slice(*job, idx)) {
+					this->enqueue(idx, job);
+					continue;
+				}
+				// the machine is done
+				job->promise.set_value(job->result);
+			} catch (...) {
+				job->promise.set_exception(std::current_exception());
+			}
+			delete job;
+			if (--m_pending == 0) {
+				// wake up everyone, in case we are stopping
+				std::lock_guard<std::mutex> lock(m_idle_mtx);
+				m_idle_cv.notify_all();
+			}
+		}
+	}
+
+	// Returns true if the machine needs more time slices
+	template <int W>
+	inline bool Executor<W>::run_slice(Job& job, unsigned idx)
+	{
+		auto& machine = *job.machine;
+		auto& stats = job.result.stats;
+		if (job.last_worker != idx) {
+			stats.migrations++;
+			job.last_worker = idx;
+		}
+		uint64_t slice = m_slice;
+		if (job.budget != 0) slice = std::min(slice, job.budget);
+
+		const uint64_t counter = machine.cpu.instruction_counter();
+		const auto t0 = std::chrono::steady_clock::now();
+		job.result.status = machine.simulate(slice);
+		stats.cpu_time += std::chrono::steady_clock::now() - t0;
+		const uint64_t executed = machine.cpu.instruction_counter() - counter;
+		stats.instructions += executed;
+		stats.slices++;
+
+		if (machine.stopped()) return false;
+		if (job.budget != 0) {
+			job.budget -= std::min(job.budget, executed);
+			if (job.budget == 0) {
+				job.result.timed_out = true;
+				return false;
+			}
+		}
+		return true;
+	}
+}
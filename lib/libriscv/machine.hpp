@@ -1,10 +1,19 @@
 #pragma once
 #include "common.hpp"
 #include "cpu.hpp"
+#include "machine_stats.hpp"
 #include "memory.hpp"
+#include "syscall_table.hpp"
 #include "util/delegate.hpp"
+#include <algorithm>
 #include <array>
-#include <errno.h> // ENOSYS
+#include <atomic>
+#include <errno.h> // ENOSYS, EFAULT
+#include <memory>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <utility>
 #include <vector>
 
 namespace riscv
@@ -13,24 +22,52 @@ namespace riscv
 	static constexpr int RISCV64 = 8;
 	static constexpr uint64_t DEFAULT_MEMORY_MAX = 16ull << 20; // 16mb
 
+	// Selects the Machine constructor that shares memory with another machine
+	struct shared_memory_t { explicit shared_memory_t() = default; };
+	inline constexpr shared_memory_t shared_memory {};
+
 	template <int W>
 	struct Machine
 	{
 		using address_t = address_type<W>;          // one unsigned memory address
-		using syscall_t = delegate<long (Machine<W>&)>;
+		using syscall_t = typename SyscallTable<W>::syscall_t;
 		Machine(const std::vector<uint8_t>& binary = {},
-				address_t max_memory = DEFAULT_MEMORY_MAX);
+				address_t max_memory = DEFAULT_MEMORY_MAX, bool verbose = false);
+		// Creates a machine that shares all memory with @main, so that
+		// guest threads can run in parallel on different host threads.
+		// It has its own CPU, starting with a copy of the registers of
+		// @main, and it uses the same system calls and userdata. Machines
+		// sharing memory take turns handling system calls, so handlers
+		// never run concurrently. @main must outlive the new machine.
+		// When it is created from inside a system call handler of @main,
+		// call use_syscall_lock() on @main before that, as the running
+		// handler doesn't hold a lock that didn't exist when it started.
+		Machine(shared_memory_t, Machine& main);
 		~Machine();
 
 		// Simulate a RISC-V machine until @max_instructions have been
 		// executed, or the machine has been stopped.
 		// NOTE: if @max_instructions is 0, then run until stop
-		void simulate(uint64_t max_instructions = 0);
-
+		// Returns 0, or -1 when a fault handler stopped the machine,
+		// in which case the details are in cpu.fault(). A fault that
+		// host code raised before the call is reported the same way.
+		int simulate(uint64_t max_instructions = 0);
+
+		// Calls @callback every @interval instructions, checked where
+		// simulate() checks the instruction limit. It can be used to
+		// preempt guest threads without them making a system call.
+		// reset_timer() starts a new interval. nullptr removes the timer.
+		void set_timer(uint64_t interval, delegate<void(Machine&)> callback);
+		void reset_timer() noexcept;
+
+		// NOTE: can be called from other host threads
 		void stop(bool v = true) noexcept;
 		bool stopped() const noexcept;
 		void reset();
 
+		// print information during machine creation, and warnings
+		bool verbose_machine;
+
 		CPU<W>    cpu;
 		Memory<W> memory;
 
@@ -41,9 +78,30 @@ namespace riscv
 
 		// Install a system call handler for a the given syscall number.
 		// Pass nullptr to uninstall a system call handler.
+		// NOTE: when a shared table is attached, the machine makes
+		// itself a private copy of the table before the first change.
 		void install_syscall_handler(int, syscall_t);
 		syscall_t get_syscall_handler(int);
 
+		// Use a frozen table of system call handlers shared with other
+		// machines. The table must outlive the machine.
+		void attach_syscall_table(const SyscallTable<W>*);
+		const auto& syscall_table() const noexcept { return *m_syscall_table; }
+
+		// Per-machine data for system call handlers in shared tables
+		template <typename T> void set_userdata(T* data) { m_userdata = data; }
+		template <typename T> T* get_userdata() const noexcept { return (T*) m_userdata; }
+
+		// Install a system call handler with typed arguments, eg.
+		// install_syscall<64>([] (Machine&, int fd, GuestSpan<const char> buf) {...})
+		// Arguments are unpacked from A0-A5 in order: integers take one register,
+		// GuestSpan<T> takes an address and an element count, T* takes one address
+		// and std::string reads a zero-terminated string. Guest buffers are
+		// validated first, and -EFAULT is returned without calling the handler
+		// when the pages are not accessible. The return value is written to A0.
+		template <int N, typename F>
+		void install_syscall(F func);
+
 		// Push all strings on stack and then create a mini-argv on SP
 		void setup_argv(const std::vector<std::string>& args);
 
@@ -96,7 +154,19 @@ namespace riscv
 		static constexpr bool verbose_registers = false;
 #endif
 		bool throw_on_unhandled_syscall = false;
+		// Handles system call N as if the guest made it, with the
+		// arguments in A0-A5 and the result in A0. It can also be
+		// used from inside a handler, eg. to run queued system calls.
 		void system_call(int);
+		// Held while a system call is handled, when memory is shared.
+		// Blocking handlers can wait on it with a condition variable.
+		std::mutex* syscall_lock() const noexcept { return m_syscall_lock.get(); }
+		// Creates the system call lock ahead of time, so that handlers
+		// hold it before any other machine shares memory with this one
+		void use_syscall_lock();
+		// System call with a number known at compile time, used by
+		// the instruction cache for ECALLs preceded by LI A7, N
+		template <int N> void direct_system_call();
 
 		// Realign the stack pointer, to make sure that vmcalls succeed
 		void realign_stack(unsigned align = 16);
@@ -109,10 +179,38 @@ namespace riscv
 		// symbol lookup cache is also kept. Returns 0 on success.
 		int deserialize_from(const std::vector<uint8_t>&);
 
+		// Remembers the current state of the machine, and from here on keeps
+		// track of the pages that are changed. restore_snapshot() returns
+		// the machine to that state in time proportional to the number of
+		// pages changed since, and returns the number of pages restored.
+		// NOTE: Only registers and memory (including memory traps) are
+		// restored. System call handlers, userdata and any state kept
+		// outside of the machine are left as they are.
+		void snapshot();
+		size_t restore_snapshot();
+
+		// Resources used by the machine so far: instructions, system
+		// calls, pages, faults, snapshots and time spent in simulate()
+		MachineStats stats() const;
+
 	private:
-		bool m_stopped = false;
-		std::array<syscall_t, 512> m_syscall_handlers;
+		SyscallTable<W>& own_syscall_table();
+		static const SyscallTable<W>& empty_syscall_table();
+
+		std::atomic<bool> m_stopped {false};
+		delegate<void(Machine&)> m_timer = nullptr;
+		uint64_t m_timer_interval = 0;
+		uint64_t m_timer_next = UINT64_MAX; // instruction counter
+		const SyscallTable<W>* m_syscall_table = &empty_syscall_table();
+		std::shared_ptr<SyscallTable<W>> m_own_syscalls = nullptr;
+		void* m_userdata = nullptr;
+		std::shared_ptr<std::mutex> m_syscall_lock = nullptr;
+		std::unique_lock<std::mutex> syscall_guard();
+		long run_syscall_handler(const syscall_t&);
+		bool m_in_syscall = false; // a handler is running
 		std::vector<delegate<void()>> m_destructor_callbacks;
+		// the counters kept by the machine itself, see stats()
+		MachineStats m_stats;
 		static_assert((W == 4 || W == 8), "Must be either 4-byte or 8-byte ISA");
 	};
 
@@ -1,11 +1,21 @@
 
 template <int W>
-inline Machine<W>::Machine(const std::vector<uint8_t>& binary, address_t maxmem)
-	: cpu(*this), memory(*this, binary, maxmem)
+inline Machine<W>::Machine(const std::vector<uint8_t>& binary, address_t maxmem, bool verbose)
+	: verbose_machine(verbose), cpu(*this), memory(*this, binary, maxmem)
 {
 	cpu.reset();
 }
 template <int W>
+inline Machine<W>::Machine(shared_memory_t, Machine<W>& main)
+	: verbose_machine(main.verbose_machine), cpu(*this), memory(*this, main.memory),
+	  m_syscall_table(main.m_syscall_table), m_own_syscalls(main.m_own_syscalls),
+	  m_userdata(main.m_userdata)
+{
+	cpu.registers() = main.cpu.registers();
+	main.use_syscall_lock();
+	this->m_syscall_lock = main.m_syscall_lock;
+}
+template <int W>
 inline Machine<W>::~Machine()
 {
 	for (auto& callback : m_destructor_callbacks) callback();
@@ -13,29 +23,88 @@ inline Machine<W>::~Machine()
 
 template <int W>
 inline void Machine<W>::stop(bool v) noexcept {
-	m_stopped = v;
+	m_stopped.store(v, std::memory_order_relaxed);
 }
 template <int W>
 inline bool Machine<W>::stopped() const noexcept {
-	return m_stopped;
+	return m_stopped.load(std::memory_order_relaxed);
 }
 
 template <int W>
-inline void Machine<W>::simulate(uint64_t max_instr)
+inline int Machine<W>::simulate(uint64_t max_instr)
 {
-	this->m_stopped = false;
-	if (max_instr != 0) {
-		max_instr += cpu.registers().counter;
-		while (LIKELY(!this->stopped())) {
-			cpu.simulate();
-			if (UNLIKELY(cpu.registers().counter >= max_instr)) break;
+	// a fault that host code raised before the run, eg. while setting
+	// up a function call, is reported before anything else happens
+	if (cpu.fault().type >= 0) {
+		if (!cpu.m_fault_reported) {
+			cpu.m_fault_reported = true;
+			return -1;
 		}
+		cpu.clear_fault();
 	}
-	else {
-		while (LIKELY(!this->stopped())) {
-			cpu.simulate();
+	this->stop(false);
+	// also counts the time until an exception leaves
+	struct Stopwatch {
+		std::chrono::nanoseconds& total;
+		const std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+		~Stopwatch() { total += std::chrono::steady_clock::now() - t0; }
+	} stopwatch { m_stats.simulate_time };
+	// faults abandon the current instruction, see CPU::trigger_exception()
+	struct Simulating {
+		bool& flag;
+		const bool old = flag;
+		~Simulating() { flag = old; }
+	} simulating { cpu.m_simulating };
+	cpu.m_simulating = true;
+
+	const uint64_t limit = (max_instr != 0)
+		? cpu.registers().counter + max_instr : UINT64_MAX;
+	for (;;) {
+		try {
+			if (max_instr != 0 || m_timer != nullptr) {
+				// one comparison per instruction covers both the limit and the timer
+				uint64_t next = std::min(limit, m_timer_next);
+				while (LIKELY(!this->stopped())) {
+					cpu.simulate();
+					if (UNLIKELY(cpu.registers().counter >= next)) {
+						if (cpu.registers().counter >= m_timer_next) {
+							this->reset_timer();
+							m_timer(*this);
+						}
+						if (cpu.registers().counter >= limit) break;
+						next = std::min(limit, m_timer_next);
+					}
+				}
+			}
+			else {
+				while (LIKELY(!this->stopped())) {
+					cpu.simulate();
+				}
+			}
+			break;
+		} catch (const typename CPU<W>::InstructionAborted&) {
+			// resumed faults run the instruction again
 		}
 	}
+	if (cpu.fault().type < 0) return 0;
+	cpu.m_fault_reported = true;
+	return -1;
+}
+
+template <int W>
+inline void Machine<W>::set_timer(uint64_t interval, delegate<void(Machine&)> callback)
+{
+	m_timer = callback;
+	m_timer_interval = interval;
+	this->reset_timer();
+}
+template <int W>
+inline void Machine<W>::reset_timer() noexcept
+{
+	if (m_timer != nullptr)
+		m_timer_next = cpu.registers().counter + m_timer_interval;
+	else
+		m_timer_next = UINT64_MAX;
 }
 
 template <int W>
@@ -48,22 +117,84 @@ inline void Machine<W>::reset()
 template <int W>
 inline void Machine<W>::install_syscall_handler(int sysn, syscall_t handler)
 {
-	m_syscall_handlers.at(sysn) = handler;
+	own_syscall_table().install_syscall_handler(sysn, handler);
 }
 template <int W> inline
 typename Machine<W>::syscall_t Machine<W>::get_syscall_handler(int sysn) {
-	return m_syscall_handlers.at(sysn);
+	return m_syscall_table->get_syscall_handler(sysn);
+}
+
+template <int W>
+inline void Machine<W>::attach_syscall_table(const SyscallTable<W>* table)
+{
+	if (UNLIKELY(!table->frozen())) {
+		throw MachineException(ILLEGAL_OPERATION,
+							"Only frozen system call tables can be shared");
+	}
+	m_syscall_table = table;
+	m_own_syscalls = nullptr;
+}
+
+template <int W>
+inline SyscallTable<W>& Machine<W>::own_syscall_table()
+{
+	if (m_own_syscalls == nullptr) {
+		// copy-on-write: start from the currently attached table
+		m_own_syscalls = std::make_shared<SyscallTable<W>> (*m_syscall_table);
+		m_own_syscalls->m_frozen = false;
+		m_syscall_table = m_own_syscalls.get();
+	}
+	return *m_own_syscalls;
+}
+template <int W>
+inline const SyscallTable<W>& Machine<W>::empty_syscall_table()
+{
+	static const SyscallTable<W> empty = [] {
+		SyscallTable<W> table;
+		table.freeze();
+		return table;
+	}();
+	return empty;
+}
+
+template <int W>
+inline void Machine<W>::use_syscall_lock()
+{
+	if (m_syscall_lock == nullptr)
+		m_syscall_lock = std::make_shared<std::mutex> ();
+}
+template <int W>
+inline std::unique_lock<std::mutex> Machine<W>::syscall_guard()
+{
+	// system calls made from inside a handler already hold the lock
+	if (UNLIKELY(m_syscall_lock != nullptr) && !m_in_syscall)
+		return std::unique_lock<std::mutex> (*m_syscall_lock);
+	return {};
+}
+
+template <int W>
+inline long Machine<W>::run_syscall_handler(const syscall_t& handler)
+{
+	struct Restore {
+		bool& flag;
+		const bool value;
+		~Restore() { flag = value; }
+	} restore { m_in_syscall, m_in_syscall };
+	m_in_syscall = true;
+	return handler(*this);
 }
 
 template <int W>
 inline void Machine<W>::system_call(int syscall_number)
 {
-	if ((size_t) syscall_number < m_syscall_handlers.size())
+	auto guard = this->syscall_guard();
+	if ((size_t) syscall_number < m_syscall_table->size())
 	{
-		auto& handler = m_syscall_handlers[syscall_number];
+		m_stats.syscalls_by_number[syscall_number]++;
+		auto& handler = (*m_syscall_table)[syscall_number];
 		if (handler != nullptr)
 		{
-			address_t ret = handler(*this);
+			address_t ret = this->run_syscall_handler(handler);
 			// EBREAK handler should not modify registers
 			if (syscall_number != SYSCALL_EBREAK) {
 				cpu.reg(RISCV::REG_RETVAL) = ret;
@@ -86,9 +217,30 @@ inline void Machine<W>::system_call(int syscall_number)
 		}
 	}
 	else {
-		throw MachineException(UNHANDLED_SYSCALL,
-								"Unhandled system call", syscall_number);
+		cpu.trigger_exception(UNHANDLED_SYSCALL, syscall_number);
+	}
+}
+
+template <int W>
+template <int N>
+inline void Machine<W>::direct_system_call()
+{
+	static_assert(N != SYSCALL_EBREAK && N >= 0 && N < SYSCALLS_MAX,
+				"Not a valid direct system call");
+	// the handler is looked up every time, so that the cached
+	// instruction always sees the currently installed handler
+	auto& handler = (*m_syscall_table)[N];
+	if (LIKELY(handler != nullptr)) {
+		auto guard = this->syscall_guard();
+		m_stats.syscalls_by_number[N]++;
+		const address_t ret = this->run_syscall_handler(handler);
+		cpu.reg(RISCV::REG_RETVAL) = ret;
+		if (UNLIKELY(this->verbose_jumps)) {
+			printf("SYSCALL %d returned %ld (0x%lX)\n", N, (long) ret, (long) ret);
+		}
+		return;
 	}
+	this->system_call(N);
 }
 
 template <int W>
@@ -146,3 +298,4 @@ inline void Machine<W>::add_destructor_callback(delegate<void()> cb)
 }
 
 #include "machine_vmcall.hpp"
+#include "machine_syscall.hpp"
@@ -0,0 +1,146 @@
+#pragma once
+#include "machine.hpp"
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <mutex>
+
+namespace riscv
+{
+	// Keeps machines for one binary that have already been set up, and
+	// hands them out. When a machine is given back, only the pages it
+	// changed are restored to how they were right after setup, and then
+	// the machine waits in the pool for the next user:
+	//
+	//	MachinePool<RISCV32> pool { binary, max_memory,
+	//		[] (auto& machine) { /* system calls, argv, run until main() */ },
+	//		[] (auto& machine) { /* reset state kept outside the machine */ } };
+	//	auto machine = pool.acquire();
+	//	machine->vmcall("on_request", ...);
+	//	// the machine is recycled when the handle goes out of scope
+	//
+	// The pool is thread-safe, and must outlive every handle it gives out.
+	template <int W>
+	struct MachinePool
+	{
+		using address_t = address_type<W>;
+		using setup_t   = std::function<void(Machine<W>&)>;
+
+		struct Recycler {
+			MachinePool* pool;
+			void operator() (Machine<W>* m) const { pool->release(m); }
+		};
+		using handle_t = std::unique_ptr<Machine<W>, Recycler>;
+
+		// Hand out a machine, setting up a new one if there are none waiting
+		handle_t acquire();
+		// Set up machines ahead of time, until @count are waiting
+		void prewarm(size_t count);
+
+		// Number of machines waiting to be handed out
+		size_t idle() const;
+		// Number of machines set up during the lifetime of the pool
+		size_t created() const;
+
+		const auto& binary() const noexcept { return m_binary; }
+
+		// @setup is called once for every new machine, after which a
+		// snapshot is taken. @reset is called for every machine given
+		// back, after its snapshot was restored. Up to @max_idle
+		// machines are kept, and machines above that are destroyed.
+		MachinePool(std::vector<uint8_t> binary, address_t max_memory,
+			setup_t setup, setup_t reset = nullptr, size_t max_idle = 16);
+		MachinePool(const MachinePool&) = delete;
+		MachinePool& operator= (const MachinePool&) = delete;
+
+	private:
+		std::unique_ptr<Machine<W>> create();
+		void release(Machine<W>*);
+
+		const std::vector<uint8_t> m_binary; // the machines refer to it
+		const address_t m_max_memory;
+		const setup_t   m_setup;
+		const setup_t   m_reset;
+		const size_t    m_max_idle;
+
+		mutable std::mutex m_mtx;
+		std::vector<std::unique_ptr<Machine<W>>> m_idle;
+		size_t m_created = 0;
+	};
+
+	template <int W>
+	inline MachinePool<W>::MachinePool(std::vector<uint8_t> binary,
+		address_t max_memory, setup_t setup, setup_t reset, size_t max_idle)
+		: m_binary(std::move(binary)), m_max_memory(max_memory),
+		  m_setup(std::move(setup)), m_reset(std::move(reset)), m_max_idle(max_idle)
+	{
+	}
+
+	template <int W>
+	inline std::unique_ptr<Machine<W>> MachinePool<W>::create()
+	{
+		auto machine = std::make_unique<Machine<W>> (m_binary, m_max_memory);
+		if (m_setup) m_setup(*machine);
+		machine->snapshot();
+		std::lock_guard<std::mutex> lock(m_mtx);
+		m_created++;
+		return machine;
+	}
+
+	template <int W>
+	inline typename MachinePool<W>::handle_t MachinePool<W>::acquire()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mtx);
+			if (!m_idle.empty()) {
+				auto* machine = m_idle.back().release();
+				m_idle.pop_back();
+				return handle_t { machine, Recycler{this} };
+			}
+		}
+		// set up a new machine outside of the lock
+		return handle_t { this->create().release(), Recycler{this} };
+	}
+
+	template <int W>
+	inline void MachinePool<W>::prewarm(size_t count)
+	{
+		while (this->idle() < std::min(count, m_max_idle))
+		{
+			auto machine = this->create();
+			std::lock_guard<std::mutex> lock(m_mtx);
+			m_idle.push_back(std::move(machine));
+		}
+	}
+
+	template <int W>
+	inline void MachinePool<W>::release(Machine<W>* ptr)
+	{
+		std::unique_ptr<Machine<W>> machine { ptr };
+		// a machine that lost its snapshot, eg. by being deserialized
+		// into, cannot be recycled
+		if (!machine->memory.has_snapshot()) return;
+		try {
+			machine->restore_snapshot();
+			if (m_reset) m_reset(*machine);
+		} catch (...) {
+			return; // not recyclable, so destroy it
+		}
+		std::lock_guard<std::mutex> lock(m_mtx);
+		if (m_idle.size() < m_max_idle)
+			m_idle.push_back(std::move(machine));
+	}
+
+	template <int W>
+	inline size_t MachinePool<W>::idle() const
+	{
+		std::lock_guard<std::mutex> lock(m_mtx);
+		return m_idle.size();
+	}
+	template <int W>
+	inline size_t MachinePool<W>::created() const
+	{
+		std::lock_guard<std::mutex> lock(m_mtx);
+		return m_created;
+	}
+}
@@ -0,0 +1,64 @@
+#pragma once
+#include "common.hpp"
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+namespace riscv
+{
+	// Resources used by a machine during its lifetime, see Machine::stats().
+	// The counters are kept all the time, as they cost next to nothing.
+	struct MachineStats
+	{
+		uint64_t instructions = 0; // retired, including those undone by restores
+		uint64_t syscalls = 0;     // all system calls together
+		std::array<uint64_t, SYSCALLS_MAX> syscalls_by_number {};
+		uint64_t pages_allocated = 0; // created on demand
+		uint64_t pages_freed  = 0;
+		size_t   pages_active = 0;
+		size_t   pages_peak   = 0; // the most pages in use at once
+		uint64_t faults    = 0;    // CPU exceptions, handled or not
+		uint64_t snapshots = 0;
+		uint64_t restores  = 0;
+		std::chrono::nanoseconds simulate_time {0}; // wall time in simulate()
+
+		// One JSON object with all of the above. Only the system
+		// calls that were made are listed in "syscalls_by_number".
+		std::string to_json() const;
+	};
+
+	inline std::string MachineStats::to_json() const
+	{
+		std::string json;
+		char buffer[96];
+		snprintf(buffer, sizeof(buffer), "{\"instructions\":%llu,\"syscalls\":%llu,",
+			(unsigned long long) instructions, (unsigned long long) syscalls);
+		json += buffer;
+		json += "\"syscalls_by_number\":{";
+		bool first = true;
+		for (size_t i = 0; i < syscalls_by_number.size(); i++) {
+			if (syscalls_by_number[i] == 0) continue;
+			snprintf(buffer, sizeof(buffer), "%s\"%zu\":%llu", first ? "" : ",",
+				i, (unsigned long long) syscalls_by_number[i]);
+			json += buffer;
+			first = false;
+		}
+		snprintf(buffer, sizeof(buffer),
+			"},\"pages_allocated\":%llu,\"pages_freed\":%llu,",
+			(unsigned long long) pages_allocated, (unsigned long long) pages_freed);
+		json += buffer;
+		snprintf(buffer, sizeof(buffer), "\"pages_active\":%zu,\"pages_peak\":%zu,",
+			pages_active, pages_peak);
+		json += buffer;
+		snprintf(buffer, sizeof(buffer), "\"faults\":%llu,\"snapshots\":%llu,\"restores\":%llu,",
+			(unsigned long long) faults, (unsigned long long) snapshots,
+			(unsigned long long) restores);
+		json += buffer;
+		snprintf(buffer, sizeof(buffer), "\"simulate_ns\":%lld}",
+			(long long) simulate_time.count());
+		json += buffer;
+		return json;
+	}
+}
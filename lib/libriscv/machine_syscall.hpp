@@ -0,0 +1,231 @@
+#pragma once
+
+// A view of an array of T in guest memory. As a system call argument
+// it takes two registers: the guest address and the number of elements.
+// The view points straight into the page when the array does not
+// cross a page boundary, and into a temporary copy otherwise.
+template <typename T>
+struct GuestSpan
+{
+	using value_type = T;
+
+	T*     data() const noexcept { return m_data; }
+	size_t size() const noexcept { return m_size; }
+	size_t size_bytes() const noexcept { return m_size * sizeof(T); }
+	bool   empty() const noexcept { return m_size == 0; }
+
+	T* begin() const noexcept { return m_data; }
+	T* end() const noexcept { return m_data + m_size; }
+	T& operator[] (size_t idx) const noexcept { return m_data[idx]; }
+
+	T*     m_data = nullptr;
+	size_t m_size = 0;
+};
+
+namespace syscall_detail
+{
+	template <typename T> struct is_span : std::false_type {};
+	template <typename T> struct is_span<GuestSpan<T>> : std::true_type {};
+
+	// the register offset of each argument, followed by the total
+	template <typename... Args> constexpr
+	std::array<int, sizeof...(Args)+1> register_offsets()
+	{
+		std::array<int, sizeof...(Args)+1> result {};
+		int arg = 0, reg = 0;
+		((result[arg++] = reg, reg += is_span<std::decay_t<Args>>::value ? 2 : 1), ...);
+		result[arg] = reg;
+		return result;
+	}
+
+	// return type and arguments (minus the machine) of a handler
+	template <typename F>
+	struct signature : signature<decltype(&F::operator())> {};
+	template <typename R, typename M, typename... Args>
+	struct signature<R(*)(M, Args...)> {
+		using result = R;
+		using args   = std::tuple<Args...>;
+	};
+	template <typename C, typename R, typename M, typename... Args>
+	struct signature<R(C::*)(M, Args...) const> : signature<R(*)(M, Args...)> {};
+
+	// validates count elements of T at addr and returns a host pointer
+	// to them, either directly into the page or into @bounce
+	template <int W, typename T>
+	T* translate(Machine<W>& machine, address_type<W> addr, size_t count,
+				std::vector<std::remove_const_t<T>>& bounce)
+	{
+		using address_t = address_type<W>;
+		constexpr bool writable = !std::is_const_v<T>;
+		auto& mem = machine.memory;
+		// never accept more than the machine could hold
+		const size_t max_bytes = mem.pages_total() * Page::size();
+		if (UNLIKELY(count == 0 || count > max_bytes / sizeof(T)))
+			return nullptr;
+		const size_t len = count * sizeof(T);
+		if (UNLIKELY(len - 1 > (address_t) (~address_t(0) - addr)))
+			return nullptr;
+
+		const size_t offset = addr & (Page::size()-1);
+		if (LIKELY(offset + len <= Page::size() && addr % alignof(T) == 0))
+		{
+			if constexpr (writable) {
+				auto& page = mem.create_page(addr >> Page::SHIFT);
+				if (UNLIKELY(!page.attr.write)) return nullptr;
+				return (T*) &page.data()[offset];
+			} else {
+				const auto& page = mem.get_page(addr);
+				if (UNLIKELY(!page.attr.read)) return nullptr;
+				return (T*) &page.data()[offset];
+			}
+		}
+		// verify every page before making a copy
+		const address_t last = (addr + len - 1) >> Page::SHIFT;
+		for (address_t pageno = addr >> Page::SHIFT; pageno <= last; pageno++)
+		{
+			const auto& attr = mem.get_pageno(pageno).attr;
+			// untouched (CoW) pages become writable pages on demand
+			const bool ok = (writable) ? (attr.write || attr.is_cow) : attr.read;
+			if (UNLIKELY(!ok)) return nullptr;
+		}
+		bounce.resize(count);
+		mem.memcpy_out(bounce.data(), addr, len);
+		return bounce.data();
+	}
+
+	template <int W, typename T, typename = void>
+	struct Argument {
+		static_assert(always_false<T>, "Unsupported system call argument type");
+	};
+	// integers and enums are taken directly from the register
+	template <int W, typename T>
+	struct Argument<W, T, std::enable_if_t<std::is_integral_v<T> || std::is_enum_v<T>>>
+	{
+		bool load(Machine<W>& machine, int reg) {
+			value = static_cast<T> (machine.cpu.reg(reg));
+			return true;
+		}
+		T    get() const noexcept { return value; }
+		void complete(Machine<W>&) {}
+
+		T value;
+	};
+	// zero-terminated strings
+	template <int W>
+	struct Argument<W, std::string>
+	{
+		bool load(Machine<W>& machine, int reg) {
+			value = machine.memory.memstring(machine.cpu.reg(reg));
+			return true;
+		}
+		const std::string& get() const noexcept { return value; }
+		void complete(Machine<W>&) {}
+
+		std::string value;
+	};
+	// address + element count
+	template <int W, typename T>
+	struct Argument<W, GuestSpan<T>>
+	{
+		using value_t = std::remove_const_t<T>;
+		static_assert(std::is_trivially_copyable_v<value_t>,
+					"GuestSpan<T> requires a trivially copyable type");
+
+		bool load(Machine<W>& machine, int reg) {
+			addr = machine.cpu.reg(reg);
+			span.m_size = machine.cpu.reg(reg + 1);
+			if (span.m_size == 0) return true;
+			span.m_data = translate<W, T> (machine, addr, span.m_size, bounce);
+			return span.m_data != nullptr;
+		}
+		GuestSpan<T> get() const noexcept { return span; }
+		void complete(Machine<W>& machine) {
+			// write back modified copies
+			if constexpr (!std::is_const_v<T>) {
+				if (!bounce.empty())
+					machine.memory.memcpy(addr, bounce.data(), span.size_bytes());
+			}
+		}
+
+		address_type<W> addr = 0;
+		GuestSpan<T> span;
+		std::vector<value_t> bounce;
+	};
+	// a single object, or nullptr when the address is zero
+	template <int W, typename T>
+	struct Argument<W, T*>
+	{
+		using value_t = std::remove_const_t<T>;
+		static_assert(std::is_trivially_copyable_v<value_t>,
+					"Pointer arguments require a trivially copyable type");
+
+		bool load(Machine<W>& machine, int reg) {
+			addr = machine.cpu.reg(reg);
+			if (addr == 0) return true;
+			ptr = translate<W, T> (machine, addr, 1, bounce);
+			return ptr != nullptr;
+		}
+		T*   get() const noexcept { return ptr; }
+		void complete(Machine<W>& machine) {
+			if constexpr (!std::is_const_v<T>) {
+				if (!bounce.empty())
+					machine.memory.memcpy(addr, bounce.data(), sizeof(T));
+			}
+		}
+
+		address_type<W> addr = 0;
+		T* ptr = nullptr;
+		std::vector<value_t> bounce;
+	};
+
+	template <int W, typename R, typename F, typename... Args, size_t... I>
+	inline long invoke(Machine<W>& machine, const F& func,
+						std::tuple<Args...>*, std::index_sequence<I...>)
+	{
+		[[maybe_unused]] constexpr auto regs = register_offsets<Args...>();
+		static_assert(regs[sizeof...(Args)] <= 6,
+					"System call arguments must fit in A0-A5");
+
+		std::tuple<Argument<W, std::decay_t<Args>>...> args;
+		if (!(std::get<I>(args).load(machine, RISCV::REG_ARG0 + regs[I]) && ...))
+			return -EFAULT;
+
+		if constexpr (std::is_void_v<R>) {
+			func(machine, std::get<I>(args).get()...);
+			(std::get<I>(args).complete(machine), ...);
+			return 0;
+		} else {
+			const long ret = func(machine, std::get<I>(args).get()...);
+			(std::get<I>(args).complete(machine), ...);
+			return ret;
+		}
+	}
+
+	// wraps a typed handler in a regular system call handler
+	template <int W, typename F>
+	inline typename SyscallTable<W>::syscall_t make_handler(F func)
+	{
+		using args_t = typename signature<F>::args;
+		using result_t = typename signature<F>::result;
+		return [func] (Machine<W>& machine) -> long {
+			return invoke<W, result_t> (machine, func, (args_t*) nullptr,
+					std::make_index_sequence<std::tuple_size_v<args_t>> {});
+		};
+	}
+} // syscall_detail
+
+template <int W>
+template <int N, typename F>
+inline void Machine<W>::install_syscall(F func)
+{
+	static_assert(N >= 0 && N < SYSCALLS_MAX, "System call number out of range");
+	this->install_syscall_handler(N, syscall_detail::make_handler<W>(func));
+}
+
+template <int W>
+template <int N, typename F>
+inline void SyscallTable<W>::install_syscall(F func)
+{
+	static_assert(N >= 0 && N < SYSCALLS_MAX, "System call number out of range");
+	this->install_syscall_handler(N, syscall_detail::make_handler<W>(func));
+}
@@ -7,7 +7,10 @@ namespace riscv
 {
 	template <int W>
 	Memory<W>::Memory(Machine<W>& mach, const std::vector<uint8_t>& bin, address_t max_mem)
-		: m_machine{mach}, m_binary{bin}, m_protect_segments {true}
+		: m_machine{mach},
+		  m_page_table{std::make_shared<PageTable<W>>()},
+		  m_pages{m_page_table->pages},
+		  m_binary{bin}, m_protect_segments {true}
 	{
 		assert(max_mem % Page::size() == 0);
 		assert(max_mem >= Page::size());
@@ -15,6 +18,24 @@ namespace riscv
 		this->reset();
 	}
 
+	template <int W>
+	Memory<W>::Memory(Machine<W>& mach, Memory<W>& main)
+		: m_machine{mach},
+		  m_start_address{main.m_start_address},
+		  m_stack_address{main.m_stack_address},
+		  m_elf_end_vaddr{main.m_elf_end_vaddr},
+		  m_pages_total{main.m_pages_total},
+		  m_page_table{main.m_page_table},
+		  m_pages{m_page_table->pages},
+		  m_page_fault_handler{main.m_page_fault_handler},
+		  m_binary{main.m_binary},
+		  m_protect_segments{main.m_protect_segments},
+		  m_exit_address{main.m_exit_address}
+	{
+		// from now on, the page table must be locked
+		m_page_table->shared = true;
+	}
+
 	template <int W>
 	void Memory<W>::reset()
 	{
@@ -28,6 +49,9 @@ namespace riscv
 	void Memory<W>::initial_paging()
 	{
 		this->m_pages.clear();
+		this->m_page_table->regions.clear();
+		this->m_page_table->no_access.clear();
+		this->drop_snapshot();
 		// make the zero-page unreadable (to trigger faults on null-pointer accesses)
 		auto& zp = this->create_page(0);
 		zp.attr = { .read = false, .write = false, .exec = false };
@@ -42,7 +66,7 @@ namespace riscv
 			throw std::runtime_error("Not enough room for ELF program segment");
 		}
 
-		if (riscv::verbose_machine) {
+		if (machine().verbose_machine) {
 		printf("* Loading program of size %zu from %p to virtual %p\n",
 				len, src, (void*) (uintptr_t) hdr->p_vaddr);
 		}
@@ -52,7 +76,7 @@ namespace riscv
 		const bool readable   = hdr->p_flags & PF_R;
 		const bool writable   = hdr->p_flags & PF_W;
 		const bool executable = hdr->p_flags & PF_X;
-		if (riscv::verbose_machine) {
+		if (machine().verbose_machine) {
 		printf("* Program segment readable: %d writable: %d  executable: %d\n",
 				readable, writable, executable);
 		}
@@ -121,7 +145,7 @@ namespace riscv
 
 		//this->relocate_section(".rela.dyn", ".symtab");
 
-		if (riscv::verbose_machine) {
+		if (machine().verbose_machine) {
 		printf("* Entry is at %p\n", (void*) (uintptr_t) this->start_address());
 		}
 	}
@@ -247,6 +271,7 @@ namespace riscv
 	{
 		const auto& it = pages().emplace(page, Page{});
 		m_pages_highest = std::max(m_pages_highest, pages().size());
+		m_pages_allocated++;
 		// if this page was read-cached, invalidate it
 		this->invalidate_page(page, it.first->second);
 		// return new page
@@ -278,6 +303,16 @@ namespace riscv
 		return zeroed_page; // read-only, zeroed page
 	}
 
+	const Page& Page::protected_page() noexcept {
+		static const Page no_access_page = [] {
+			Page page;
+			page.attr = { .read = false, .write = false, .exec = false };
+			page.m_dirty = true; // never tracked
+			return page;
+		}();
+		return no_access_page;
+	}
+
 	template struct Memory<4>;
 }
 
@@ -3,12 +3,16 @@
 #include "elf.hpp"
 #include "types.hpp"
 #include "page.hpp"
+#include "shared_region.hpp"
 #include "util/delegate.hpp"
 #include <cassert>
 #include <cstring>
 #include <EASTL/string.h>
 #include <EASTL/string_map.h>
 #include <EASTL/unordered_map.h>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
 
@@ -16,6 +20,38 @@ namespace riscv
 {
 	template<int W> struct Machine;
 
+	// The pages of a memory, which machines running on different host
+	// threads can share. Once shared, the page table is locked while
+	// being looked up or changed, and atomic instructions are serialized.
+	// Pages are never erased from a shared table, as other machines may
+	// be holding on to them, so that Page pointers stay valid.
+	template<int W>
+	struct PageTable
+	{
+		eastl::unordered_map<address_type<W>, Page> pages;
+		// host-owned regions, which pages missing from the table fall back to
+		struct SharedMapping {
+			address_type<W> pageno; // first page
+			PageAttributes  attr;
+			std::shared_ptr<SharedRegion> region;
+		};
+		std::vector<SharedMapping> regions;
+		// untouched pages that may not be accessed at all, as ranges of
+		// page numbers, which are only created once that changes
+		std::map<address_type<W>, address_type<W>> no_access; // first -> end
+		std::recursive_mutex page_lock;
+		std::mutex atomic_lock;
+		bool shared = false;
+	};
+
+	// A piece of guest memory, as a buffer on the host
+	template <typename T>
+	struct MemorySpan
+	{
+		T*     ptr;
+		size_t len;
+	};
+
 	template<int W>
 	struct Memory
 	{
@@ -29,6 +65,12 @@ namespace riscv
 
 		template <typename T>
 		void write(address_t dst, T value);
+		// Read-modify-write for atomic instructions: @op gets a host
+		// pointer to the aligned T at @addr and returns the old value,
+		// using host atomics to stay atomic towards other machines
+		// sharing this memory. Trapped pages are emulated under a lock.
+		template <typename T, typename Op>
+		T atomic(address_t addr, Op op);
 
 		void memset(address_t dst, uint8_t value, size_t len);
 		void memcpy(address_t dst, const void* src, size_t);
@@ -37,6 +79,14 @@ namespace riscv
 		// of optimizing away a copy if the data crosses no page-boundaries
 		void memview(address_t addr, size_t len,
 					delegate<void(const uint8_t*, size_t)> callback);
+		// Appends the guest memory at [addr, addr+len) to @spans as host
+		// buffers, one for each page, without copying, eg. for readv or
+		// writev. Returns false if the guest could not have read (or
+		// written) all of it directly, because of page permissions or
+		// traps. The buffers are valid until the pages are freed.
+		bool gather(address_t addr, size_t len, std::vector<MemorySpan<const uint8_t>>& spans);
+		// same, for writing, which creates the pages as needed
+		bool gather_writable(address_t addr, size_t len, std::vector<MemorySpan<uint8_t>>& spans);
 		// gives const-ref access to pod-type T in guest memory
 		template <typename T>
 		void memview(address_t addr, delegate<void(const T&)> callback);
@@ -58,17 +108,39 @@ namespace riscv
 		// page handling
 		size_t pages_active() const noexcept { return m_pages.size(); }
 		size_t pages_highest_active() const noexcept { return m_pages_highest; }
+		// pages created and freed over the lifetime of the memory
+		uint64_t pages_allocated() const noexcept { return m_pages_allocated; }
+		uint64_t pages_freed() const noexcept { return m_pages_freed; }
 		size_t pages_total() const noexcept { return this->m_pages_total; }
 		void set_pages_total(size_t new_max) noexcept { this->m_pages_total = new_max; }
 		auto& pages() noexcept { return m_pages; }
 		const Page& get_page(address_t) const noexcept;
 		const Page& get_pageno(address_t npage) const noexcept;
 		Page& create_page(address_t npage);
+		// create_page() for pages that are only going to be read from
+		// or executed, which are not remembered as changed
+		Page& create_page_untracked(address_t npage);
+		// Pages that were never touched are left that way when they
+		// are made inaccessible, and read as the protected page
 		void  set_page_attr(address_t, size_t len, PageAttributes);
 		const PageAttributes& get_page_attr(address_t) const noexcept;
 		// page creation & destruction
 		Page& allocate_page(const size_t page);
 		void  free_pages(address_t, size_t len);
+		// move whole pages and their attributes from @src to @dst, after
+		// which @src reads as zeroes. Pages that were never created stay
+		// that way at @dst.
+		void  move_pages(address_t dst, address_t src, size_t len);
+		// Maps all of @region at @addr, which must be page-aligned, so
+		// that the guest accesses the host-owned pages directly. @attr
+		// decides whether the guest can read and write them (executing
+		// is not supported), and the pages that were there are freed.
+		// Throws MachineException when the region doesn't fit there.
+		// Machines sharing this memory have to be stopped while it's done.
+		void  map_shared(address_t addr, std::shared_ptr<SharedRegion>, PageAttributes attr);
+		// Removes the region mapped at @addr, which then reads as zeroes.
+		// Machines sharing this memory have to be stopped while it's done.
+		bool  unmap_shared(address_t addr);
 		// page faults
 		void set_page_fault_handler(page_fault_cb_t h) { this->m_page_fault_handler = h; }
 		static Page& default_page_fault(Memory&, const size_t page);
@@ -76,21 +148,41 @@ namespace riscv
 		void trap(address_t page_addr, mmio_cb_t callback);
 
 		const auto& binary() const noexcept { return m_binary; }
+		bool is_shared() const noexcept { return m_page_table->shared; }
+		// held while the page table is looked up or changed
+		std::unique_lock<std::recursive_mutex> page_table_guard() const;
+		// held while emulating atomic instructions on trapped pages
+		std::unique_lock<std::mutex> atomic_guard() const;
 		void reset();
 		// serializes all the machine state + a tiny header to @vec
 		void serialize_to(std::vector<uint8_t>& vec);
 		// returns the machine to a previously stored state
 		void deserialize_from(const std::vector<uint8_t>&, const SerializedMachine<W>&);
+		// see Machine::snapshot()
+		void snapshot();
+		size_t restore_snapshot();
+		bool has_snapshot() const noexcept { return m_tracking; }
+		// number of pages changed since the snapshot, at most
+		size_t pages_dirty() const noexcept { return m_dirty.size(); }
 
 		Memory(Machine<W>&, const std::vector<uint8_t>&, address_t max_mem);
+		// Shares all pages with @main, see Machine's shared_memory constructor
+		Memory(Machine<W>&, Memory<W>& main);
 	private:
 		inline auto& create_attr(const address_t address);
 		static inline uintptr_t page_number(const address_t address) {
 			return address >> Page::SHIFT;
 		}
 		void initial_paging();
+		void drop_snapshot();
+		const Page* shared_page(address_t pageno) const;
+		Page* shared_page_writable(address_t pageno);
+		Page& scratch_page();
+		bool  is_no_access(address_t pageno) const;
+		void  set_no_access(address_t first, address_t end, bool);
+		bool gather_fits(address_t addr, size_t len) const noexcept;
 		void invalidate_page(address_t pageno, Page&);
-		void protection_fault();
+		bool protection_fault(address_t);
 #ifdef RISCV_INSTR_CACHE
 		void generate_decoder_cache(address_t, size_t);
 #endif
@@ -122,13 +214,23 @@ namespace riscv
 		address_t m_elf_end_vaddr = 0;
 		size_t    m_pages_total   = 0; // max memory usage
 		size_t    m_pages_highest = 0; // max pages used
+		uint64_t  m_pages_allocated = 0;
+		uint64_t  m_pages_freed = 0;
 
 		const Page* m_current_rd_ptr  = nullptr;
 		address_t   m_current_rd_page = -1;
 		Page*     m_current_wr_ptr  = nullptr;
 		address_t m_current_wr_page = -1;
-		eastl::unordered_map<address_t, Page> m_pages;
+		std::shared_ptr<PageTable<W>> m_page_table;
+		eastl::unordered_map<address_t, Page>& m_pages; // m_page_table->pages
 		page_fault_cb_t m_page_fault_handler = nullptr;
+		// handed out instead of shared pages that may not be written
+		std::unique_ptr<Page> m_scratch_page = nullptr;
+		// the pages as they were at the snapshot, and the pages changed since
+		eastl::unordered_map<address_t, Page> m_snapshot;
+		std::map<address_t, address_t> m_snapshot_no_access;
+		std::vector<address_t> m_dirty;
+		bool m_tracking = false;
 
 		const std::vector<uint8_t>& m_binary;
 		const bool m_protect_segments;
@@ -6,8 +6,14 @@ T Memory<W>::read(address_t address)
 {
 	const auto pageno = page_number(address);
 	if (m_current_rd_page != pageno) {
-		m_current_rd_page = pageno;
 		m_current_rd_ptr = &get_pageno(pageno);
+		// another machine sharing the page table can create the page,
+		// or unmap the region it is from, at any time, so the zero page
+		// and shared regions are not remembered for it
+		const bool uncached = UNLIKELY(m_page_table->shared) &&
+			(m_current_rd_ptr == &Page::cow_page() || m_current_rd_ptr == &Page::protected_page()
+			|| !m_page_table->regions.empty());
+		m_current_rd_page = uncached ? address_t(-1) : pageno;
 	}
 	const auto& page = *m_current_rd_ptr;
 
@@ -19,7 +25,12 @@ T Memory<W>::read(address_t address)
 	if (LIKELY(page.attr.read)) {
 		return page.template aligned_read<T>(address & (Page::size()-1));
 	}
-	this->protection_fault();
+	// a fault handler may resolve the fault, so look again once
+	if (this->protection_fault(address)) {
+		m_current_rd_ptr = &get_pageno(pageno);
+		if (m_current_rd_ptr->attr.read)
+			return m_current_rd_ptr->template aligned_read<T>(address & (Page::size()-1));
+	}
 	return T {};
 }
 
@@ -44,7 +55,45 @@ void Memory<W>::write(address_t address, T value)
 		page.template aligned_write<T>(address & (Page::size()-1), value);
 		return;
 	}
-	this->protection_fault();
+	// a fault handler may resolve the fault, so look again once
+	if (this->protection_fault(address)) {
+		m_current_wr_ptr = &create_page(pageno);
+		if (m_current_wr_ptr->attr.write)
+			m_current_wr_ptr->template aligned_write<T>(address & (Page::size()-1), value);
+	}
+}
+
+template <int W>
+template <typename T, typename Op>
+T Memory<W>::atomic(address_t address, Op op)
+{
+	if (UNLIKELY(address % sizeof(T) != 0)) {
+		machine().cpu.trigger_exception(INVALID_ALIGNMENT, address);
+		return T {};
+	}
+	const auto pageno = page_number(address);
+	if (m_current_wr_page != pageno) {
+		m_current_wr_page = pageno;
+		m_current_wr_ptr = &create_page(pageno);
+	}
+	auto* page = m_current_wr_ptr;
+
+	if constexpr (memory_traps_enabled) {
+		if (UNLIKELY(page->has_trap())) {
+			auto guard = this->atomic_guard();
+			T value = this->template read<T> (address);
+			const T old = op(&value);
+			this->template write<T> (address, value);
+			return old;
+		}
+	}
+	if (UNLIKELY(!page->attr.read || !page->attr.write)) {
+		// a fault handler may resolve the fault, so look again once
+		if (!this->protection_fault(address)) return T {};
+		page = m_current_wr_ptr = &create_page(pageno);
+		if (!page->attr.read || !page->attr.write) return T {};
+	}
+	return op((T*) &page->data()[address & (Page::size()-1)]);
 }
 
 template <int W>
@@ -57,10 +106,18 @@ inline const Page& Memory<W>::get_page(const address_t address) const noexcept
 template <int W>
 inline const Page& Memory<W>::get_pageno(const address_t page) const noexcept
 {
+	auto guard = this->page_table_guard();
+	// regions come first, as pages may be left behind under them
+	if (UNLIKELY(!m_page_table->regions.empty())) {
+		if (const Page* shared = this->shared_page(page))
+			return *shared;
+	}
 	auto it = m_pages.find(page);
 	if (it != m_pages.end()) {
 		return it->second;
 	}
+	if (UNLIKELY(!m_page_table->no_access.empty()) && this->is_no_access(page))
+		return Page::protected_page();
 	// uninitialized memory is all zeroes on this system
 	return Page::cow_page();
 }
@@ -68,10 +125,32 @@ inline const Page& Memory<W>::get_pageno(const address_t page) const noexcept
 template <int W>
 inline Page& Memory<W>::create_page(const address_t pageno)
 {
+	auto& page = this->create_page_untracked(pageno);
+	// remember which pages were changed after a snapshot
+	if (UNLIKELY(m_tracking && !page.m_dirty)) {
+		page.m_dirty = true;
+		m_dirty.push_back(pageno);
+	}
+	return page;
+}
+
+template <int W>
+inline Page& Memory<W>::create_page_untracked(const address_t pageno)
+{
+	auto guard = this->page_table_guard();
+	// shared page tables keep freed pages, and snapshots can bring
+	// pages back, so a region hides whatever is below it
+	if (UNLIKELY(!m_page_table->regions.empty())) {
+		if (Page* shared = this->shared_page_writable(pageno))
+			return *shared;
+	}
 	auto it = m_pages.find(pageno);
 	if (it != m_pages.end()) {
 		return it->second;
 	}
+	// an untouched page that may not be accessed stays untouched
+	if (UNLIKELY(!m_page_table->no_access.empty()) && this->is_no_access(pageno))
+		return this->scratch_page();
 	// create page on-demand, or throw exception when out of memory
 	if (this->m_page_fault_handler == nullptr) {
 		return default_page_fault(*this, pageno);
@@ -82,13 +161,24 @@ inline Page& Memory<W>::create_page(const address_t pageno)
 template <int W> inline void
 Memory<W>::set_page_attr(address_t dst, size_t len, PageAttributes options)
 {
+	auto guard = this->page_table_guard();
 	const bool is_default = options.is_default();
+	const bool no_access = !options.read && !options.write && !options.exec;
 	while (len > 0)
 	{
 		const size_t size = std::min(Page::size(), len);
 		const size_t pageno = dst >> Page::SHIFT;
+		if (UNLIKELY(!m_page_table->no_access.empty()))
+			this->set_no_access(pageno, pageno + 1, false);
+		if (UNLIKELY(!m_page_table->regions.empty()) && this->shared_page(pageno)) {
+			// the attributes of shared regions belong to their mapping
+		}
+		else if (no_access && m_pages.find(pageno) == m_pages.end()) {
+			// the protected page stands in for it, until touched
+			this->set_no_access(pageno, pageno + 1, true);
+		}
 		// unfortunately, have to create pages for non-default attrs
-		if (!is_default) {
+		else if (!is_default) {
 			this->create_page(pageno).attr = options;
 		} else {
 			// set attr on non-COW pages only!
@@ -107,7 +197,15 @@ Memory<W>::set_page_attr(address_t dst, size_t len, PageAttributes options)
 template <int W> inline
 const PageAttributes& Memory<W>::get_page_attr(address_t src) const noexcept
 {
-	const size_t pageno = src >> Page::SHIFT;
+	const address_t pageno = src >> Page::SHIFT;
+	if (UNLIKELY(!m_page_table->regions.empty())) {
+		auto guard = this->page_table_guard();
+		// the attributes of shared regions belong to their mapping
+		for (const auto& mapping : m_page_table->regions) {
+			if (pageno - mapping.pageno < mapping.region->pages())
+				return mapping.attr;
+		}
+	}
 	const auto& page = this->get_pageno(pageno);
 	return page.attr;
 }
@@ -125,19 +223,196 @@ Memory<W>::invalidate_page(address_t pageno, Page& page)
 template <int W> inline void
 Memory<W>::free_pages(address_t dst, size_t len)
 {
+	auto guard = this->page_table_guard();
 	while (len > 0)
 	{
 		const size_t size = std::min(Page::size(), len);
 		const address_t pageno = dst >> Page::SHIFT;
-		auto& page = this->get_pageno(pageno);
-		if (page.attr.is_cow == false) {
-			m_pages.erase(pageno);
+		if (UNLIKELY(!m_page_table->no_access.empty()))
+			this->set_no_access(pageno, pageno + 1, false);
+		auto it = m_pages.find(pageno);
+		if (it != m_pages.end()) {
+			if (m_tracking) m_dirty.push_back(pageno);
+			m_pages_freed++;
+			if (LIKELY(!m_page_table->shared)) {
+				m_pages.erase(it);
+			} else {
+				// other machines may be using the page, so clear it instead
+				it->second.attr = {};
+				std::memset(it->second.data(), 0, Page::size());
+			}
+			// forget the cached pages, as they may be gone
+			if (m_current_rd_page == pageno) m_current_rd_page = -1;
+			if (m_current_wr_page == pageno) m_current_wr_page = -1;
 		}
 		dst += size;
 		len -= size;
 	}
 }
 
+template <int W> inline void
+Memory<W>::move_pages(address_t dst, address_t src, size_t len)
+{
+	assert(dst % Page::size() == 0 && src % Page::size() == 0);
+	assert(len % Page::size() == 0);
+	auto guard = this->page_table_guard();
+	for (size_t n = 0; n < len; n += Page::size())
+	{
+		auto it = m_pages.find(page_number(src + n));
+		if (it == m_pages.end()) {
+			// untouched, so the destination stays untouched too
+			const bool no_access = this->is_no_access(page_number(src + n));
+			this->free_pages(dst + n, Page::size());
+			this->free_pages(src + n, Page::size());
+			if (no_access)
+				this->set_no_access(page_number(dst + n), page_number(dst + n) + 1, true);
+			continue;
+		}
+		const Page& from = it->second;
+		auto& page = this->create_page(page_number(dst + n));
+		std::copy(from.data(), from.data() + Page::size(), page.data());
+		page.attr = from.attr;
+		this->free_pages(src + n, Page::size());
+	}
+}
+
+template <int W> inline
+const Page* Memory<W>::shared_page(address_t pageno) const
+{
+	for (const auto& mapping : m_page_table->regions)
+	{
+		const address_t n = pageno - mapping.pageno;
+		if (n < mapping.region->pages()) {
+			return mapping.attr.read ? &mapping.region->page(n) : &Page::protected_page();
+		}
+	}
+	return nullptr;
+}
+template <int W> inline
+Page* Memory<W>::shared_page_writable(address_t pageno)
+{
+	for (const auto& mapping : m_page_table->regions)
+	{
+		const address_t n = pageno - mapping.pageno;
+		if (n < mapping.region->pages()) {
+			return mapping.attr.write ? &mapping.region->page(n) : &this->scratch_page();
+		}
+	}
+	return nullptr;
+}
+template <int W> inline
+bool Memory<W>::is_no_access(address_t pageno) const
+{
+	const auto& ranges = m_page_table->no_access;
+	auto it = ranges.upper_bound(pageno);
+	return it != ranges.begin() && pageno < std::prev(it)->second;
+}
+// Adds [first, end) to the no-access ranges, merging it with the ranges
+// it touches, or takes it out of them
+template <int W> inline void
+Memory<W>::set_no_access(address_t first, address_t end, bool enable)
+{
+	auto& ranges = m_page_table->no_access;
+	auto it = ranges.upper_bound(first);
+	if (it != ranges.begin()) {
+		const address_t prev_end = std::prev(it)->second;
+		if (prev_end > first || (enable && prev_end == first)) --it;
+	}
+	if (!enable && (it == ranges.end() || it->first >= end))
+		return;
+	while (it != ranges.end() && (it->first < end || (enable && it->first == end)))
+	{
+		const address_t begin = it->first;
+		const address_t stop  = it->second;
+		it = ranges.erase(it);
+		if (enable) {
+			first = std::min(first, begin);
+			end = std::max(end, stop);
+		} else {
+			if (begin < first) ranges.emplace(begin, first);
+			if (stop > end) {
+				ranges.emplace(end, stop);
+				break;
+			}
+		}
+	}
+	if (enable) ranges.emplace(first, end);
+	// the cached pages may have been the protected page
+	m_current_rd_page = -1;
+	m_current_wr_page = -1;
+}
+// Host code writes to the pages it is given without looking at their
+// attributes, so a page that may not be written is replaced by one that
+// belongs to this machine alone, and is cleared every time.
+template <int W> inline
+Page& Memory<W>::scratch_page()
+{
+	if (m_scratch_page == nullptr)
+		m_scratch_page.reset(new Page);
+	auto& page = *m_scratch_page;
+	std::memset(page.data(), 0, Page::size());
+	page.attr = { .read = false, .write = false, .exec = false };
+	page.set_trap(nullptr);
+	page.m_dirty = true; // never tracked
+	return page;
+}
+
+template <int W> inline void
+Memory<W>::map_shared(address_t addr, std::shared_ptr<SharedRegion> region, PageAttributes attr)
+{
+	assert(addr % Page::size() == 0);
+	if (attr.exec)
+		throw MachineException(ILLEGAL_OPERATION, "Shared regions cannot be executable");
+	const address_t first = page_number(addr);
+	const size_t count = region->pages();
+	if (count == 0 || count > page_number(address_t(-1)) + 1 - first)
+		throw MachineException(ILLEGAL_OPERATION, "Shared region does not fit at the address", addr);
+	auto guard = this->page_table_guard();
+	for (const auto& mapping : m_page_table->regions) {
+		if (first < mapping.pageno + mapping.region->pages()
+			&& mapping.pageno < first + count)
+			throw MachineException(ILLEGAL_OPERATION, "Shared region overlaps another region", addr);
+	}
+	this->free_pages(addr, count * Page::size());
+	m_page_table->regions.push_back({first, attr, std::move(region)});
+	// the cached pages may be zero pages that are now shared
+	m_current_rd_page = -1;
+	m_current_wr_page = -1;
+}
+
+template <int W> inline bool
+Memory<W>::unmap_shared(address_t addr)
+{
+	auto guard = this->page_table_guard();
+	auto& regions = m_page_table->regions;
+	for (auto it = regions.begin(); it != regions.end(); ++it)
+	{
+		if (it->pageno == page_number(addr)) {
+			regions.erase(it);
+			m_current_rd_page = -1;
+			m_current_wr_page = -1;
+			return true;
+		}
+	}
+	return false;
+}
+
+template <int W> inline
+std::unique_lock<std::recursive_mutex> Memory<W>::page_table_guard() const
+{
+	if (UNLIKELY(m_page_table->shared))
+		return std::unique_lock<std::recursive_mutex> (m_page_table->page_lock);
+	return {};
+}
+
+template <int W> inline
+std::unique_lock<std::mutex> Memory<W>::atomic_guard() const
+{
+	if (UNLIKELY(m_page_table->shared))
+		return std::unique_lock<std::mutex> (m_page_table->atomic_lock);
+	return {};
+}
+
 template <int W>
 void Memory<W>::memset(address_t dst, uint8_t value, size_t len)
 {
@@ -199,10 +474,60 @@ void Memory<W>::memview(address_t addr, size_t len,
 		callback(page.data() + offset, len);
 		return;
 	}
-	// slow path
-	uint8_t buffer[len];
-	memcpy_out(buffer, addr, len);
-	callback(buffer, len);
+	// slow path, see gather() to avoid the copy
+	std::unique_ptr<uint8_t[]> buffer { new uint8_t[len] };
+	memcpy_out(buffer.get(), addr, len);
+	callback(buffer.get(), len);
+}
+
+template <int W> inline
+bool Memory<W>::gather_fits(address_t addr, size_t len) const noexcept
+{
+	// never accept more than the machine could hold
+	return len <= m_pages_total * Page::size()
+		&& len <= address_t(~address_t(0) - addr);
+}
+
+template <int W>
+bool Memory<W>::gather(address_t addr, size_t len,
+	std::vector<MemorySpan<const uint8_t>>& spans)
+{
+	if (UNLIKELY(!gather_fits(addr, len)))
+		return false;
+	while (len != 0)
+	{
+		const size_t offset = addr & (Page::size()-1);
+		const size_t size = std::min(Page::size() - offset, len);
+		const auto& page = this->get_page(addr);
+		if (UNLIKELY(!page.attr.read || page.has_trap()))
+			return false;
+		spans.push_back({&page.data()[offset], size});
+
+		addr += size;
+		len -= size;
+	}
+	return true;
+}
+
+template <int W>
+bool Memory<W>::gather_writable(address_t addr, size_t len,
+	std::vector<MemorySpan<uint8_t>>& spans)
+{
+	if (UNLIKELY(!gather_fits(addr, len)))
+		return false;
+	while (len != 0)
+	{
+		const size_t offset = addr & (Page::size()-1);
+		const size_t size = std::min(Page::size() - offset, len);
+		auto& page = this->create_page(addr >> Page::SHIFT);
+		if (UNLIKELY(!page.attr.write || page.has_trap()))
+			return false;
+		spans.push_back({&page.data()[offset], size});
+
+		addr += size;
+		len -= size;
+	}
+	return true;
 }
 template <int W>
 template <typename T>
@@ -263,9 +588,9 @@ std::string Memory<W>::memstring(address_t addr, const size_t max_len)
 }
 
 template <int W>
-inline void Memory<W>::protection_fault()
+inline bool Memory<W>::protection_fault(address_t addr)
 {
-	machine().cpu.trigger_exception(PROTECTION_FAULT);
+	return machine().cpu.trigger_exception(PROTECTION_FAULT, addr);
 }
 
 template <int W>
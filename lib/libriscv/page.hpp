@@ -70,17 +70,25 @@ struct Page
 	}
 
 	static const Page& cow_page() noexcept;
+	// stands in for pages that the guest may not read
+	static const Page& protected_page() noexcept;
 
 #ifdef RISCV_INSTR_CACHE
 	auto* decoder_cache() noexcept {
-		return m_decoder_cache;
+		return __atomic_load_n(&m_decoder_cache, __ATOMIC_ACQUIRE);
 	}
 	const auto* decoder_cache() const noexcept {
-		return m_decoder_cache;
+		return __atomic_load_n(&m_decoder_cache, __ATOMIC_ACQUIRE);
 	}
+	// machines sharing memory can race to create the cache of a page,
+	// in which case the first one is kept
 	template <typename T>
 	inline void create_decoder_cache() {
-		m_decoder_cache = new T;
+		DecoderCache* expected = nullptr;
+		T* cache = new T;
+		if (!__atomic_compare_exchange_n(&m_decoder_cache, &expected, cache,
+				false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+			delete cache;
 	}
 #endif
 
@@ -99,6 +107,8 @@ struct Page
 	DecoderCache* m_decoder_cache = nullptr;
 #endif
 	mmio_cb_t m_trap = nullptr;
+	// changed since the last snapshot of the memory
+	bool m_dirty = false;
 };
 
 inline int64_t Page::trap(uint32_t offset, int mode, int64_t value) const
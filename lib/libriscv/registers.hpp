@@ -45,13 +45,50 @@ namespace riscv
 		auto& get(uint32_t idx) { return m_reg[idx]; }
 		const auto& get(uint32_t idx) const { return m_reg[idx]; }
 
-		auto& getfl(uint32_t idx) { return m_regfl[idx]; }
+		// Mutable access to the FP registers marks them as used
+		auto& getfl(uint32_t idx) { m_fp_used = true; return m_regfl[idx]; }
 		const auto& getfl(uint32_t idx) const { return m_regfl[idx]; }
 
 		auto& at(uint32_t idx) { return m_reg.at(idx); }
 		const auto& at(uint32_t idx) const { return m_reg.at(idx); }
 
-		auto& fcsr() noexcept { return m_fcsr; }
+		auto& fcsr() noexcept { m_fp_used = true; return m_fcsr; }
+
+		// Like the FS field of mstatus: whether the FP registers may
+		// have changed since clear_fp_used(), so that context switches
+		// only have to save them when they were actually used.
+		bool fp_used() const noexcept { return m_fp_used; }
+		void clear_fp_used() noexcept { m_fp_used = false; }
+
+		// The integer registers and pc, all a context switch needs
+		struct IntegerFile {
+			std::array<register_t, 32> reg;
+			address_t pc;
+
+			auto& get(uint32_t idx) { return reg[idx]; }
+			const auto& get(uint32_t idx) const { return reg[idx]; }
+		};
+		// The FP registers and fcsr, saved separately
+		struct FloatFile {
+			std::array<fp64reg, 32> regfl;
+			uint32_t fcsr;
+		};
+		void save(IntegerFile& dst) const noexcept {
+			dst.reg = m_reg;
+			dst.pc  = this->pc;
+		}
+		void restore(const IntegerFile& src) noexcept {
+			m_reg = src.reg;
+			this->pc = src.pc;
+		}
+		void save(FloatFile& dst) const noexcept {
+			dst.regfl = m_regfl;
+			dst.fcsr  = m_fcsr.whole;
+		}
+		void restore(const FloatFile& src) noexcept {
+			m_regfl = src.regfl;
+			m_fcsr.whole = src.fcsr;
+		}
 
 		std::string to_string() const
 		{
@@ -100,6 +137,7 @@ namespace riscv
 			};
 			uint32_t whole = 0;
 		} m_fcsr;
+		bool m_fp_used = false;
 	};
 
 	static_assert(sizeof(fp64reg) == 8, "FP-register is 64-bit");
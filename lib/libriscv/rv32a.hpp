@@ -1,24 +1,36 @@
 #pragma once
 #include <cstdint>
-#include <unordered_set>
 #include "types.hpp"
 
 namespace riscv
 {
+	// The reservation set of one hart. Like real hardware there is only
+	// one reservation, and a new LR replaces the previous one.
 	template <int W>
 	struct AtomicMemory
 	{
 		using address_t = address_type<W>;          // one unsigned memory address
 
-		void load_reserve(address_t addr)
+		// remember the value loaded by LR
+		void load_reserve(address_t addr, uint32_t value) noexcept
 		{
-			m_reservations.insert(addr);
+			m_addr  = addr;
+			m_value = value;
+			m_valid = true;
 		}
-		bool store_conditional(address_t addr)
+		// SC uses up the reservation, whether it succeeds or not. The
+		// store happens only if the memory still has the value loaded by
+		// LR, even if another CPU wrote to it in between.
+		bool store_conditional(address_t addr, uint32_t& expected) noexcept
 		{
-			return m_reservations.erase(addr) != 0;
+			const bool valid = m_valid && m_addr == addr;
+			m_valid = false;
+			expected = m_value;
+			return valid;
 		}
 
-		std::unordered_set<address_t> m_reservations;
+		address_t m_addr  = 0;
+		uint32_t  m_value = 0;
+		bool      m_valid = false;
 	};
 }
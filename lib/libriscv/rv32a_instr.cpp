@@ -3,90 +3,142 @@
 
 namespace riscv
 {
-	ATOMIC_INSTR(AMOADD_W,
-	[] (auto& cpu, rv32i_instruction instr)
+	// 1. apply <op> to the word at [rs1] and rs2, as one host atomic
+	// 2. place the old value into rd
+	template <typename CPU, typename Op>
+	static inline void amo_word(CPU& cpu, rv32i_instruction instr, Op op)
 	{
-		if (instr.Atype.rs1 != 0)
+		if (instr.Atype.rs1 != 0 && instr.Atype.funct3 == 0x2)
 		{
-			// 1. load value from rs1
 			const auto addr = cpu.reg(instr.Atype.rs1);
-			auto value = cpu.machine().memory.template read<uint32_t> (addr);
-			// 2. place value into rd
+			const uint32_t value = cpu.reg(instr.Atype.rs2);
+			const uint32_t old = cpu.machine().memory.template atomic<uint32_t> (addr,
+				[value, op] (uint32_t* ptr) { return op(ptr, value); });
 			if (instr.Atype.rd != 0) {
-				cpu.reg(instr.Atype.rd) = value;
+				cpu.reg(instr.Atype.rd) = old;
 			}
-			// 3. apply <add> to value and rs2
-			value += cpu.reg(instr.Atype.rs2);
-			// 4. write value back to [rs1]
-			cpu.machine().memory.template write<uint32_t> (addr, value);
 			return;
 		}
 		cpu.trigger_exception(ILLEGAL_OPERATION);
-	},
-	[] (char* buffer, size_t len, auto&, rv32i_instruction instr) -> int {
-		return snprintf(buffer, len, "AMOADD.W %s %s, %s",
+	}
+
+	// MIN and MAX have no host atomic, so they retry until nobody
+	// else changed the word between our load and our store
+	template <typename T, typename Pick>
+	static inline uint32_t amo_select(uint32_t* ptr, uint32_t value, Pick pick)
+	{
+		uint32_t old = __atomic_load_n(ptr, __ATOMIC_RELAXED);
+		while (!__atomic_compare_exchange_n(ptr, &old, pick((T) old, (T) value) ? old : value,
+				true, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
+		return old;
+	}
+
+	static inline int print_amo(char* buffer, size_t len, const char* name,
+		rv32i_instruction instr)
+	{
+		return snprintf(buffer, len, "%s %s %s, %s", name,
                         RISCV::regname(instr.Atype.rs1),
                         RISCV::regname(instr.Atype.rs2),
                         RISCV::regname(instr.Atype.rd));
+	}
+
+	ATOMIC_INSTR(AMOADD_W,
+	[] (auto& cpu, rv32i_instruction instr)
+	{
+		amo_word(cpu, instr, [] (uint32_t* ptr, uint32_t value) {
+			return __atomic_fetch_add(ptr, value, __ATOMIC_SEQ_CST);
+		});
+	},
+	[] (char* buffer, size_t len, auto&, rv32i_instruction instr) -> int {
+		return print_amo(buffer, len, "AMOADD.W", instr);
 	});
 
     ATOMIC_INSTR(AMOSWAP_W,
 	[] (auto& cpu, rv32i_instruction instr)
 	{
-		if (instr.Atype.rs1 != 0)
-		{
-			// 1. load value from rs1
-			const auto addr = cpu.reg(instr.Atype.rs1);
-			auto value = cpu.machine().memory.template read<uint32_t> (addr);
-			// 2. place value into rd
-			if (instr.Atype.rd != 0) {
-				cpu.reg(instr.Atype.rd) = value;
-			}
-			// 3. apply <swap> to value and rs2
-			if (instr.Atype.rs2 != 0) {
-				std::swap(value, cpu.reg(instr.Atype.rs2));
-			}
-			else {
-				value = 0;
-			}
-			// 4. write value back to [rs1]
-			cpu.machine().memory.template write<uint32_t> (addr, value);
-			return;
-		}
-		cpu.trigger_exception(ILLEGAL_OPERATION);
+		amo_word(cpu, instr, [] (uint32_t* ptr, uint32_t value) {
+			return __atomic_exchange_n(ptr, value, __ATOMIC_SEQ_CST);
+		});
 	},
 	[] (char* buffer, size_t len, auto&, rv32i_instruction instr) -> int {
-		return snprintf(buffer, len, "AMOSWAP.W %s %s, %s",
-                        RISCV::regname(instr.Atype.rs1),
-                        RISCV::regname(instr.Atype.rs2),
-                        RISCV::regname(instr.Atype.rd));
+		return print_amo(buffer, len, "AMOSWAP.W", instr);
+	});
+
+	ATOMIC_INSTR(AMOXOR_W,
+	[] (auto& cpu, rv32i_instruction instr)
+	{
+		amo_word(cpu, instr, [] (uint32_t* ptr, uint32_t value) {
+			return __atomic_fetch_xor(ptr, value, __ATOMIC_SEQ_CST);
+		});
+	},
+	[] (char* buffer, size_t len, auto&, rv32i_instruction instr) -> int {
+		return print_amo(buffer, len, "AMOXOR.W", instr);
 	});
 
 	ATOMIC_INSTR(AMOOR_W,
 	[] (auto& cpu, rv32i_instruction instr)
 	{
-		if (instr.Atype.rs1 != 0)
-		{
-			// 1. load value from rs1
-			const auto addr = cpu.reg(instr.Atype.rs1);
-			auto value = cpu.machine().memory.template read<uint32_t> (addr);
-			// 2. place value into rd
-			if (instr.Atype.rd != 0) {
-				cpu.reg(instr.Atype.rd) = value;
-			}
-			// 3. apply <or> to value and rs2
-			value |= cpu.reg(instr.Atype.rs2);
-			// 4. write value back to [rs1]
-			cpu.machine().memory.template write<uint32_t> (addr, value);
-			return;
-		}
-		cpu.trigger_exception(ILLEGAL_OPERATION);
+		amo_word(cpu, instr, [] (uint32_t* ptr, uint32_t value) {
+			return __atomic_fetch_or(ptr, value, __ATOMIC_SEQ_CST);
+		});
 	},
 	[] (char* buffer, size_t len, auto&, rv32i_instruction instr) -> int {
-		return snprintf(buffer, len, "AMOOR.W %s %s, %s",
-                        RISCV::regname(instr.Atype.rs1),
-                        RISCV::regname(instr.Atype.rs2),
-                        RISCV::regname(instr.Atype.rd));
+		return print_amo(buffer, len, "AMOOR.W", instr);
+	});
+
+	ATOMIC_INSTR(AMOAND_W,
+	[] (auto& cpu, rv32i_instruction instr)
+	{
+		amo_word(cpu, instr, [] (uint32_t* ptr, uint32_t value) {
+			return __atomic_fetch_and(ptr, value, __ATOMIC_SEQ_CST);
+		});
+	},
+	[] (char* buffer, size_t len, auto&, rv32i_instruction instr) -> int {
+		return print_amo(buffer, len, "AMOAND.W", instr);
+	});
+
+	ATOMIC_INSTR(AMOMIN_W,
+	[] (auto& cpu, rv32i_instruction instr)
+	{
+		amo_word(cpu, instr, [] (uint32_t* ptr, uint32_t value) {
+			return amo_select<int32_t> (ptr, value, [] (auto a, auto b) { return a < b; });
+		});
+	},
+	[] (char* buffer, size_t len, auto&, rv32i_instruction instr) -> int {
+		return print_amo(buffer, len, "AMOMIN.W", instr);
+	});
+
+	ATOMIC_INSTR(AMOMAX_W,
+	[] (auto& cpu, rv32i_instruction instr)
+	{
+		amo_word(cpu, instr, [] (uint32_t* ptr, uint32_t value) {
+			return amo_select<int32_t> (ptr, value, [] (auto a, auto b) { return a > b; });
+		});
+	},
+	[] (char* buffer, size_t len, auto&, rv32i_instruction instr) -> int {
+		return print_amo(buffer, len, "AMOMAX.W", instr);
+	});
+
+	ATOMIC_INSTR(AMOMINU_W,
+	[] (auto& cpu, rv32i_instruction instr)
+	{
+		amo_word(cpu, instr, [] (uint32_t* ptr, uint32_t value) {
+			return amo_select<uint32_t> (ptr, value, [] (auto a, auto b) { return a < b; });
+		});
+	},
+	[] (char* buffer, size_t len, auto&, rv32i_instruction instr) -> int {
+		return print_amo(buffer, len, "AMOMINU.W", instr);
+	});
+
+	ATOMIC_INSTR(AMOMAXU_W,
+	[] (auto& cpu, rv32i_instruction instr)
+	{
+		amo_word(cpu, instr, [] (uint32_t* ptr, uint32_t value) {
+			return amo_select<uint32_t> (ptr, value, [] (auto a, auto b) { return a > b; });
+		});
+	},
+	[] (char* buffer, size_t len, auto&, rv32i_instruction instr) -> int {
+		return print_amo(buffer, len, "AMOMAXU.W", instr);
 	});
 
     ATOMIC_INSTR(LOAD_RESV,
@@ -94,9 +146,11 @@ namespace riscv
 		// handler
 		if (instr.Atype.funct3 == 0x2 && instr.Atype.rs2 == 0)
 		{
+			// LR is only useful on memory SC can write to
 			const auto addr = cpu.reg(instr.Atype.rs1);
-			cpu.atomics().load_reserve(addr);
-			auto value = cpu.machine().memory.template read<uint32_t> (addr);
+			const uint32_t value = cpu.machine().memory.template atomic<uint32_t> (addr,
+				[] (uint32_t* ptr) { return __atomic_load_n(ptr, __ATOMIC_SEQ_CST); });
+			cpu.atomics().load_reserve(addr, value);
 			if (instr.Atype.rd != 0)
 				cpu.reg(instr.Atype.rd) = value;
 			return;
@@ -112,16 +166,25 @@ namespace riscv
     ATOMIC_INSTR(STORE_COND,
 	[] (auto& cpu, rv32i_instruction instr) {
 		// handler
-		if (instr.Atype.funct3 == 0x2 && instr.Atype.rs2 != 0)
+		if (instr.Atype.funct3 == 0x2)
 		{
 			const auto addr = cpu.reg(instr.Atype.rs1);
-			const bool resv = cpu.atomics().store_conditional(addr);
+			uint32_t expected;
+			bool resv = cpu.atomics().store_conditional(addr, expected);
 			if (resv) {
-				auto value = cpu.machine().memory.template read<uint32_t> (addr);
-				cpu.reg(instr.Atype.rs2) = value;
+				// store rs2 only if the word still has the value from LR
+				const uint32_t value = cpu.reg(instr.Atype.rs2);
+				const uint32_t old = cpu.machine().memory.template atomic<uint32_t> (addr,
+					[expected, value] (uint32_t* ptr) {
+						uint32_t current = expected;
+						__atomic_compare_exchange_n(ptr, &current, value,
+							false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+						return current;
+					});
+				resv = (old == expected);
 			}
 			if (instr.Atype.rd != 0)
-				cpu.reg(instr.Atype.rd) = (resv) ? 0 : -1;
+				cpu.reg(instr.Atype.rd) = (resv) ? 0 : 1;
 			return;
 		}
 		cpu.trigger_exception(ILLEGAL_OPERATION);
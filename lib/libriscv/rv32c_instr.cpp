@@ -121,9 +121,10 @@ namespace riscv
 	COMPRESSED_INSTR(C1_JAL,
 	[] (auto& cpu, rv32i_instruction instr) {
 		auto ci = instr.compressed();
-		cpu.reg(RISCV::REG_RA) = cpu.pc() + 2; // return instruction
+		const auto link = cpu.pc() + 2; // return instruction
 		const auto address = cpu.pc() + ci.CJ.signed_imm();
 		cpu.jump(address - 2);
+		cpu.reg(RISCV::REG_RA) = link;
 		if (UNLIKELY(cpu.machine().verbose_jumps)) {
 			printf(">>> CALL 0x%X <-- %s = 0x%X\n", address,
 					RISCV::regname(RISCV::REG_RA), cpu.reg(RISCV::REG_RA));
@@ -406,11 +407,14 @@ namespace riscv
 		}
 		else if (topbit && ci.CR.rd != 0 && ci.CR.rs2 == 0)
 		{	// JALR ra, rd+0
-			cpu.reg(RISCV::REG_RA) = cpu.pc() + 0x2;
-			cpu.jump(cpu.reg(ci.CR.rd) - 2);
+			// the target is read before RA is written, as rd may be RA
+			const auto address = cpu.reg(ci.CR.rd);
+			const auto link = cpu.pc() + 0x2;
+			cpu.jump(address - 2);
+			cpu.reg(RISCV::REG_RA) = link;
 			if (UNLIKELY(cpu.machine().verbose_jumps)) {
-				printf(">>> C.JAL RA, 0x%X <-- %s = 0x%X\n", cpu.reg(RISCV::REG_RA) - 2,
-						RISCV::regname(ci.CR.rd), cpu.reg(ci.CR.rd));
+				printf(">>> C.JAL RA, 0x%X <-- %s = 0x%X\n", address,
+						RISCV::regname(ci.CR.rd), address);
 			}
 		}
 		else if (!topbit && ci.CR.rd != 0 && ci.CR.rs2 != 0)
@@ -23,6 +23,61 @@ namespace riscv
 #undef DECODER
 	}
 
+#ifdef RISCV_INSTR_CACHE
+	// ECALL where the system call number was loaded as a constant right
+	// before it. A7 is still verified, as the ECALL can be a jump target.
+	template <int N>
+	static void direct_ecall(CPU<4>& cpu, rv32i_instruction)
+	{
+		if constexpr (N != SYSCALL_EBREAK) {
+			if (LIKELY(cpu.reg(RISCV::REG_ECALL) == N)) {
+				cpu.machine().template direct_system_call<N>();
+				return;
+			}
+		}
+		cpu.machine().system_call(cpu.reg(RISCV::REG_ECALL));
+	}
+	template <size_t... N>
+	static constexpr auto make_direct_ecalls(std::index_sequence<N...>) {
+		return std::array<CPU<4>::instruction_t::handler_t, sizeof...(N)> {
+			&direct_ecall<N>...
+		};
+	}
+	static constexpr auto direct_ecalls =
+		make_direct_ecalls(std::make_index_sequence<SYSCALLS_MAX> {});
+
+	template<>
+	CPU<4>::instruction_t::handler_t
+	CPU<4>::decode_for_cache(const format_t instruction, address_t pc) const
+	{
+		static constexpr uint32_t ECALL = 0x00000073;
+		if (instruction.whole == ECALL)
+		{
+			// look for LI A7, N just before the ECALL, on the same page
+			const address_t offset = pc & (Page::size()-1);
+			const auto* page = m_current_page.page;
+			int sysno = -1;
+			if (compressed_enabled && offset >= 2) {
+				// C.LI A7, imm
+				const rv32c_instruction ci {
+					page->template aligned_read<uint16_t> (offset - 2) };
+				if ((ci.whole & 0xEF83) == 0x4881 && ci.CI.imm2 == 0)
+					sysno = ci.CI.imm1;
+			}
+			if (sysno < 0 && offset >= 4) {
+				// ADDI A7, ZERO, imm
+				const format_t li {
+					page->template aligned_read<uint32_t> (offset - 4) };
+				if ((li.whole & 0xFFFFF) == 0x00893 && !li.Itype.sign())
+					sysno = li.Itype.imm;
+			}
+			if (sysno > 0 && sysno < SYSCALLS_MAX)
+				return direct_ecalls[sysno];
+		}
+		return decode(instruction).handler;
+	}
+#endif
+
 	std::string RV32I::to_string(CPU<4>& cpu, format_t format, const instruction_t& instr)
 	{
 		char buffer[256];
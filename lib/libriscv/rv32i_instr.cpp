@@ -154,11 +154,13 @@ namespace riscv
 	[] (auto& cpu, rv32i_instruction instr) {
 		// jump to register + immediate
 		const auto address = cpu.reg(instr.Itype.rs1) + instr.Itype.signed_imm();
+		const auto link = cpu.pc() + 4;
+		// jump first, so that a misaligned target leaves rd alone
+		cpu.jump(address - 4);
 		// Link *next* instruction (rd = PC + 4)
 		if (LIKELY(instr.Itype.rd != 0)) {
-			cpu.reg(instr.Itype.rd) = cpu.pc() + 4;
+			cpu.reg(instr.Itype.rd) = link;
 		}
-		cpu.jump(address - 4);
 		if (UNLIKELY(cpu.machine().verbose_jumps)) {
 		printf(">>> JMP 0x%X <-- %s = 0x%X%+d\n", address,
 				RISCV::regname(instr.Itype.rs1), cpu.reg(instr.Itype.rs1), instr.Itype.signed_imm());
@@ -174,12 +176,13 @@ namespace riscv
 
 	INSTRUCTION(JAL,
 	[] (auto& cpu, rv32i_instruction instr) {
-		// Link *next* instruction (rd = PC + 4)
+		const auto link = cpu.pc() + 4;
+		// Jump (relative), before rd is written
+		cpu.jump(cpu.pc() + instr.Jtype.jump_offset() - 4);
+		// And link *next* instruction (rd = PC + 4)
 		if (LIKELY(instr.Jtype.rd != 0)) {
-			cpu.reg(instr.Jtype.rd) = cpu.pc() + 4;
+			cpu.reg(instr.Jtype.rd) = link;
 		}
-		// And Jump (relative)
-		cpu.jump(cpu.pc() + instr.Jtype.jump_offset() - 4);
 		if (UNLIKELY(cpu.machine().verbose_jumps)) {
 			printf(">>> CALL 0x%X <-- %s = 0x%X\n", cpu.pc(),
 					RISCV::regname(instr.Jtype.rd), cpu.reg(instr.Jtype.rd));
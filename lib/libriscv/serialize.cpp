@@ -22,6 +22,12 @@ namespace riscv
 		uint64_t addr;
 		PageAttributes attr;
 	};
+	// follows the pages: the number of no-access ranges, then the ranges
+	struct SerializedRange
+	{
+		uint64_t first;
+		uint64_t end;
+	};
 
 	template <int W>
 	void Machine<W>::serialize_to(std::vector<uint8_t>& vec)
@@ -68,6 +74,15 @@ namespace riscv
 			auto* pptr = page.data();
 			vec.insert(vec.end(), pptr, pptr + Page::size());
 		}
+		const uint64_t n_ranges = m_page_table->no_access.size();
+		auto* nptr = (const uint8_t*) &n_ranges;
+		vec.insert(vec.end(), nptr, nptr + sizeof(n_ranges));
+		for (const auto& it : m_page_table->no_access)
+		{
+			const SerializedRange range { .first = it.first, .end = it.second };
+			auto* rptr = (const uint8_t*) &range;
+			vec.insert(vec.end(), rptr, rptr + sizeof(SerializedRange));
+		}
 	}
 
 	template <int W>
@@ -97,13 +112,7 @@ namespace riscv
 		// restore CPU registers and counters
 		this->m_regs = *(const Registers<W>*) &vec[state.cpu_offset];
 		this->m_atomics = {};
-		// reset the instruction page pointer
-		this->m_current_page = {};
-#ifdef RISCV_PAGE_CACHE
-		// reset the page cache
-		this->m_page_cache = {};
-		this->m_cache_iterator = 0;
-#endif
+		this->invalidate_page_cache();
 	}
 	template <int W>
 	void Memory<W>::deserialize_from(const std::vector<uint8_t>& vec,
@@ -116,6 +125,8 @@ namespace riscv
 		// completely reset the paging system as
 		// all pages will be completely replaced
 		this->m_pages.clear();
+		this->m_page_table->no_access.clear();
+		this->drop_snapshot();
 		this->m_current_rd_page = -1;
 		this->m_current_rd_ptr  = nullptr;
 		this->m_current_wr_page = -1;
@@ -129,6 +140,16 @@ namespace riscv
 			m_pages.emplace(page.addr, Page{page.attr, data, nullptr});
 			off += Page::size();
 		}
+		// older states end with the pages
+		if (vec.size() < off + sizeof(uint64_t)) return;
+		const uint64_t n_ranges = *(const uint64_t*) &vec[off];
+		off += sizeof(uint64_t);
+		assert(vec.size() >= off + n_ranges * sizeof(SerializedRange));
+		for (size_t r = 0; r < n_ranges; r++) {
+			const auto& range = *(const SerializedRange*) &vec[off];
+			m_page_table->no_access.emplace(range.first, range.end);
+			off += sizeof(SerializedRange);
+		}
 	}
 
 	template struct Machine<4>;
@@ -0,0 +1,116 @@
+#pragma once
+#include "page.hpp"
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+
+namespace riscv
+{
+	// Pages owned by the host, which several machines can map at once
+	// with Memory::map_shared(). Nothing is copied: the host and every
+	// machine read and write the very same pages, so that one guest can
+	// hand a large message to another by writing it into the region:
+	//
+	//	auto region = std::make_shared<SharedRegion>(1 << 20);
+	//	producer.memory.map_shared(0x70000000, region, { .read = true, .write = true });
+	//	consumer.memory.map_shared(0x70000000, region, { .read = true, .write = false });
+	//
+	// The pages are not part of snapshots, nor of serialized machines.
+	// Machines running on different host threads have to synchronize
+	// their use of the region themselves, eg. with atomic instructions.
+	struct SharedRegion
+	{
+		// Called after a guest stored @size bytes at @offset in the region
+		using write_cb_t = std::function<void(SharedRegion&, size_t offset, size_t size)>;
+
+		size_t size() const noexcept { return m_count * Page::size(); }
+		size_t pages() const noexcept { return m_count; }
+		Page& page(size_t n) noexcept { return m_pages[n]; }
+		const Page& page(size_t n) const noexcept { return m_pages[n]; }
+
+		// host access to the region, which is not contiguous in host memory
+		void memcpy(size_t offset, const void* src, size_t len);
+		void memcpy_out(void* dst, size_t offset, size_t len) const;
+
+		// Calls @callback after every store that a guest makes to the
+		// region, or stops doing so when it is nullptr. This turns the
+		// pages into trapped pages, which makes every access much slower,
+		// and only works when MEMORY_TRAPS_ENABLED is defined.
+		void set_write_trap(write_cb_t callback);
+
+		// @len is rounded up to whole pages, which start out zeroed
+		SharedRegion(size_t len);
+		SharedRegion(const SharedRegion&) = delete;
+		SharedRegion& operator= (const SharedRegion&) = delete;
+
+	private:
+		const size_t m_count;
+		std::unique_ptr<Page[]> m_pages;
+		write_cb_t m_on_write = nullptr;
+	};
+
+	inline SharedRegion::SharedRegion(size_t len)
+		: m_count((len + Page::size() - 1) / Page::size()),
+		  m_pages(new Page[m_count])
+	{
+		for (size_t n = 0; n < m_count; n++) {
+			// the pages never become part of a snapshot
+			m_pages[n].m_dirty = true;
+		}
+	}
+
+	inline void SharedRegion::memcpy(size_t offset, const void* vsrc, size_t len)
+	{
+		auto* src = (const uint8_t*) vsrc;
+		if (offset > size() || len > size() - offset)
+			throw std::out_of_range("SharedRegion::memcpy outside of the region");
+		while (len != 0)
+		{
+			const size_t pageoff = offset & (Page::size()-1);
+			const size_t size = std::min(Page::size() - pageoff, len);
+			std::copy(src, src + size, page(offset >> Page::SHIFT).data() + pageoff);
+
+			src += size;
+			offset += size;
+			len -= size;
+		}
+	}
+
+	inline void SharedRegion::memcpy_out(void* vdst, size_t offset, size_t len) const
+	{
+		auto* dst = (uint8_t*) vdst;
+		if (offset > size() || len > size() - offset)
+			throw std::out_of_range("SharedRegion::memcpy_out outside of the region");
+		while (len != 0)
+		{
+			const size_t pageoff = offset & (Page::size()-1);
+			const size_t size = std::min(Page::size() - pageoff, len);
+			const auto* data = page(offset >> Page::SHIFT).data() + pageoff;
+			std::copy(data, data + size, dst);
+
+			dst += size;
+			offset += size;
+			len -= size;
+		}
+	}
+
+	inline void SharedRegion::set_write_trap(write_cb_t callback)
+	{
+		m_on_write = std::move(callback);
+		for (size_t n = 0; n < m_count; n++)
+		{
+			if (m_on_write == nullptr) {
+				m_pages[n].set_trap(nullptr);
+				continue;
+			}
+			m_pages[n].set_trap(
+			[this, n] (Page& page, uint32_t offset, int mode, int64_t value) -> int64_t {
+				const int64_t result = page.passthrough(offset, mode, value);
+				if (Page::trap_mode(mode) == TRAP_WRITE)
+					m_on_write(*this, n * Page::size() + offset, mode & 0xFFF);
+				return result;
+			});
+		}
+	}
+}
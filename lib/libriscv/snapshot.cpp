@@ -0,0 +1,120 @@
+#include "machine.hpp"
+
+namespace riscv
+{
+	template <int W>
+	void Machine<W>::snapshot()
+	{
+		cpu.snapshot();
+		memory.snapshot();
+		m_stats.snapshots++;
+	}
+	template <int W>
+	size_t Machine<W>::restore_snapshot()
+	{
+		assert(memory.has_snapshot());
+		const size_t pages = memory.restore_snapshot();
+		// the instructions executed since the snapshot were still retired
+		const uint64_t counter = cpu.instruction_counter();
+		cpu.restore_snapshot();
+		if (counter > cpu.instruction_counter())
+			m_stats.instructions += counter - cpu.instruction_counter();
+		m_stats.restores++;
+		return pages;
+	}
+
+	template <int W>
+	MachineStats Machine<W>::stats() const
+	{
+		MachineStats stats = m_stats;
+		stats.instructions += cpu.instruction_counter();
+		for (auto count : stats.syscalls_by_number) stats.syscalls += count;
+		stats.pages_allocated = memory.pages_allocated();
+		stats.pages_freed  = memory.pages_freed();
+		stats.pages_active = memory.pages_active();
+		stats.pages_peak   = memory.pages_highest_active();
+		stats.faults = cpu.faults();
+		return stats;
+	}
+
+	template <int W>
+	void CPU<W>::snapshot()
+	{
+		this->m_snapshot_regs = this->m_regs;
+	}
+	template <int W>
+	void CPU<W>::restore_snapshot()
+	{
+		this->m_regs = this->m_snapshot_regs;
+		this->m_atomics = {};
+		this->clear_fault();
+		// restored pages may have been erased
+		this->invalidate_page_cache();
+	}
+	template <int W>
+	void CPU<W>::invalidate_page_cache() noexcept
+	{
+		this->m_current_page = {};
+#ifdef RISCV_PAGE_CACHE
+		this->m_page_cache = {};
+		this->m_cache_iterator = 0;
+#endif
+	}
+
+	template <int W>
+	void Memory<W>::snapshot()
+	{
+		if (UNLIKELY(this->is_shared())) {
+			throw MachineException(ILLEGAL_OPERATION,
+				"Memory shared between machines cannot be snapshotted");
+		}
+		this->m_snapshot.clear();
+		this->m_dirty.clear();
+		for (auto& it : this->m_pages) {
+			it.second.m_dirty = false;
+			m_snapshot.emplace(it.first, it.second);
+		}
+		this->m_snapshot_no_access = m_page_table->no_access;
+		this->m_tracking = true;
+		// the next write to the cached page must be seen
+		this->m_current_wr_page = -1;
+		this->m_current_wr_ptr  = nullptr;
+	}
+	template <int W>
+	size_t Memory<W>::restore_snapshot()
+	{
+		// a page can be listed more than once, when it was
+		// freed and created again, but that is harmless
+		for (const address_t pageno : this->m_dirty)
+		{
+			auto it = m_snapshot.find(pageno);
+			if (it != m_snapshot.end()) {
+				m_pages[pageno] = it->second;
+			} else {
+				// the page was created after the snapshot
+				m_pages_freed += m_pages.erase(pageno);
+			}
+		}
+		const size_t count = m_dirty.size();
+		this->m_dirty.clear();
+		m_page_table->no_access = this->m_snapshot_no_access;
+		// the cached pages may be gone
+		this->m_current_rd_page = -1;
+		this->m_current_rd_ptr  = nullptr;
+		this->m_current_wr_page = -1;
+		this->m_current_wr_ptr  = nullptr;
+		return count;
+	}
+	template <int W>
+	void Memory<W>::drop_snapshot()
+	{
+		this->m_snapshot.clear();
+		this->m_snapshot_no_access.clear();
+		this->m_dirty.clear();
+		this->m_tracking = false;
+	}
+
+	template struct Machine<4>;
+	template struct CPU<4>;
+	template struct Memory<4>;
+}
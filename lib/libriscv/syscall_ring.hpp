@@ -0,0 +1,168 @@
+#pragma once
+#include "machine.hpp"
+
+namespace riscv
+{
+	// A submission/completion ring in guest memory. The guest queues up
+	// system calls in the submission queue and then makes one system call
+	// (or lets the host poll between time slices) to have all of them
+	// handled at once. Each handled submission produces a completion
+	// carrying the user data and the system call return value.
+	//
+	// All fields are register-sized, and the queues are indexed with
+	// free-running counters masked by (entries - 1). The guest owns
+	// sq_tail and cq_head, the host owns sq_head and cq_tail.
+	//
+	// Submitted system calls are made with Machine::system_call(), with
+	// A0-A5 and A7 set from the submission, so they are counted, locked
+	// and treated as unhandled just like the ones the guest makes. The
+	// registers are restored afterwards, also when a handler throws.
+	// Handlers that switch threads or otherwise change the execution
+	// context cannot be used from the ring.
+	template <int W>
+	struct SyscallRing
+	{
+		using address_t = address_type<W>;
+		static constexpr address_t MAX_ENTRIES = 4096;
+
+		struct Header {
+			address_t sq_head;
+			address_t sq_tail;
+			address_t cq_head;
+			address_t cq_tail;
+			address_t entries;  // power of two, same for both queues
+			address_t sq_addr;  // Submission[entries]
+			address_t cq_addr;  // Completion[entries]
+		};
+		struct Submission {
+			address_t sysno;
+			address_t user_data;
+			address_t args[6];
+		};
+		struct Completion {
+			address_t user_data;
+			address_t result;
+		};
+
+		// Returns 0 if the header at @addr describes a usable ring,
+		// otherwise a negative errno value
+		static long validate(Machine<W>&, address_t addr);
+
+		// Handles pending submissions until the submission queue is empty
+		// or the completion queue is full, and returns the number of
+		// completions produced, or a negative errno value on a bad ring.
+		long process();
+
+		// True if there are unhandled submissions
+		bool pending() const;
+
+		address_t address() const noexcept { return m_addr; }
+
+		SyscallRing(Machine<W>& m, address_t addr) : m_machine(m), m_addr(addr) {}
+	private:
+		Header read_header() const;
+
+		Machine<W>& m_machine;
+		const address_t m_addr;
+	};
+
+	template <int W>
+	inline typename SyscallRing<W>::Header SyscallRing<W>::read_header() const
+	{
+		Header hdr;
+		m_machine.memory.memcpy_out(&hdr, m_addr, sizeof(hdr));
+		return hdr;
+	}
+
+	template <int W>
+	inline long SyscallRing<W>::validate(Machine<W>& machine, address_t addr)
+	{
+		if (addr == 0 || addr % sizeof(address_t) != 0)
+			return -EFAULT;
+		Header hdr;
+		machine.memory.memcpy_out(&hdr, addr, sizeof(hdr));
+		const address_t n = hdr.entries;
+		if (n == 0 || n > MAX_ENTRIES || (n & (n - 1)) != 0)
+			return -EINVAL;
+		if (hdr.sq_addr % sizeof(address_t) != 0 || hdr.cq_addr % sizeof(address_t) != 0)
+			return -EFAULT;
+		return 0;
+	}
+
+	template <int W>
+	inline bool SyscallRing<W>::pending() const
+	{
+		const Header hdr = read_header();
+		return hdr.sq_head != hdr.sq_tail;
+	}
+
+	template <int W>
+	inline long SyscallRing<W>::process()
+	{
+		const long status = validate(m_machine, m_addr);
+		if (UNLIKELY(status < 0)) return status;
+
+		Header hdr = read_header();
+		const address_t mask = hdr.entries - 1;
+		// the guest could have given us anything
+		if (UNLIKELY(hdr.sq_tail - hdr.sq_head > hdr.entries
+				  || hdr.cq_tail - hdr.cq_head > hdr.entries))
+			return -EINVAL;
+
+		auto& cpu = m_machine.cpu;
+		// A0-A7, restored when we are done
+		struct SavedRegisters {
+			CPU<W>& cpu;
+			address_t regs[8];
+			SavedRegisters(CPU<W>& c) : cpu(c) {
+				for (int i = 0; i < 8; i++) regs[i] = cpu.reg(RISCV::REG_ARG0 + i);
+			}
+			~SavedRegisters() {
+				for (int i = 0; i < 8; i++) cpu.reg(RISCV::REG_ARG0 + i) = regs[i];
+			}
+		} saved { cpu };
+		// publish the new positions of the host-owned counters
+		auto publish = [&] {
+			m_machine.memory.template write<address_t> (
+				m_addr + offsetof(Header, sq_head), hdr.sq_head);
+			m_machine.memory.template write<address_t> (
+				m_addr + offsetof(Header, cq_tail), hdr.cq_tail);
+		};
+
+		long completions = 0;
+		try {
+			while (hdr.sq_head != hdr.sq_tail
+				&& hdr.cq_tail - hdr.cq_head < hdr.entries
+				&& !m_machine.stopped())
+			{
+				Submission sqe;
+				m_machine.memory.memcpy_out(&sqe,
+					hdr.sq_addr + (hdr.sq_head & mask) * sizeof(Submission), sizeof(sqe));
+				hdr.sq_head++;
+
+				Completion cqe { sqe.user_data, (address_t) -ENOSYS };
+				// EBREAK doesn't return anything
+				if (sqe.sysno != SYSCALL_EBREAK && sqe.sysno < SYSCALLS_MAX)
+				{
+					const bool handled = sqe.sysno < m_machine.syscall_table().size()
+						&& m_machine.syscall_table()[sqe.sysno] != nullptr;
+					for (int i = 0; i < 6; i++)
+						cpu.reg(RISCV::REG_ARG0 + i) = sqe.args[i];
+					cpu.reg(RISCV::REG_ECALL) = sqe.sysno;
+					m_machine.system_call(sqe.sysno);
+					if (handled) cqe.result = cpu.reg(RISCV::REG_RETVAL);
+				}
+				m_machine.memory.memcpy(
+					hdr.cq_addr + (hdr.cq_tail & mask) * sizeof(Completion), &cqe, sizeof(cqe));
+				hdr.cq_tail++;
+				completions++;
+			}
+		} catch (...) {
+			// the submission that threw is consumed, without a completion
+			publish();
+			throw;
+		}
+		publish();
+		return completions;
+	}
+}
@@ -0,0 +1,57 @@
+#pragma once
+#include "common.hpp"
+#include "types.hpp"
+#include "util/delegate.hpp"
+#include <array>
+
+namespace riscv
+{
+	template<int W> struct Machine;
+
+	// A set of system call handlers that can be built once, frozen and
+	// then attached to any number of machines. Handlers that need
+	// per-machine state should fetch it with Machine::get_userdata().
+	template <int W>
+	struct SyscallTable
+	{
+		using syscall_t = delegate<long (Machine<W>&)>;
+
+		// Install a system call handler for a the given syscall number.
+		// Pass nullptr to uninstall a system call handler.
+		void install_syscall_handler(int, syscall_t);
+		// See: Machine::install_syscall
+		template <int N, typename F>
+		void install_syscall(F func);
+		const syscall_t& get_syscall_handler(int) const;
+
+		// A frozen table can no longer be modified, and is safe
+		// to share between machines, including across threads.
+		void freeze() noexcept { m_frozen = true; }
+		bool frozen() const noexcept { return m_frozen; }
+
+		static constexpr size_t size() noexcept { return SYSCALLS_MAX; }
+		const syscall_t& operator[] (size_t idx) const noexcept { return m_handlers[idx]; }
+
+	private:
+		std::array<syscall_t, SYSCALLS_MAX> m_handlers;
+		bool m_frozen = false;
+		friend struct Machine<W>;
+	};
+
+	template <int W>
+	inline void SyscallTable<W>::install_syscall_handler(int sysn, syscall_t handler)
+	{
+		if (UNLIKELY(m_frozen)) {
+			throw MachineException(ILLEGAL_OPERATION,
+								"System call table is frozen", sysn);
+		}
+		m_handlers.at(sysn) = handler;
+	}
+
+	template <int W> inline
+	const typename SyscallTable<W>::syscall_t&
+	SyscallTable<W>::get_syscall_handler(int sysn) const
+	{
+		return m_handlers.at(sysn);
+	}
+}
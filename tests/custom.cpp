@@ -17,4 +17,28 @@ void test_custom_machine()
 	assert(m2.cpu.registers().counter == 0);
 	assert(m2.cpu.registers().pc == entry_point);
 	assert(m2.free_memory() == 65536);
+
+	// moving pages leaves zeroes behind, and does not create pages
+	// for the parts of the source that were never written to
+	m2.memory.memset(0x4000, 0x55, 100);
+	m2.memory.memset(0x6000, 0x66, 100);
+	m2.memory.move_pages(0x8000, 0x4000, 3 * riscv::Page::size());
+	assert(m2.memory.read<uint8_t> (0x8000) == 0x55);
+	assert(m2.memory.read<uint8_t> (0xA000) == 0x66);
+	assert(m2.memory.read<uint8_t> (0x4000) == 0);
+	assert(m2.memory.pages_active() == 2);
+
+	// a buffer across pages is seen as one span per page
+	std::vector<riscv::MemorySpan<uint8_t>> out;
+	assert(m2.memory.gather_writable(0x3F00, 0x1200, out));
+	assert(out.size() == 3 && out[0].len == 0x100 && out[2].len == 0x100);
+	for (auto& span : out) std::fill(span.ptr, span.ptr + span.len, 0x77);
+	std::vector<riscv::MemorySpan<const uint8_t>> in;
+	assert(m2.memory.gather(0x3F00, 0x1200, in) && in.size() == 3);
+	assert(in[1].ptr[0] == 0x77 && m2.memory.read<uint8_t> (0x50FF) == 0x77);
+	// and nothing is given for memory the guest can't access
+	in.clear();
+	m2.memory.set_page_attr(0x5000, riscv::Page::size(), { .read = false });
+	assert(!m2.memory.gather(0x3F00, 0x1200, in));
+	assert(!m2.memory.gather(0x1000, 0x100000, in));
 }
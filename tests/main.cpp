@@ -1,17 +1,43 @@
 #include <cstdio>
 
 extern void test_custom_machine();
+extern void test_coroutine();
 extern void test_crashes();
+extern void test_executor();
+extern void test_faults();
+extern void test_files();
+extern void test_mmap_area();
+extern void test_native_heap();
+extern void test_parallel();
+extern void test_pool();
+extern void test_rv32a();
 extern void test_rv32i();
 extern void test_rv32c();
+extern void test_shared();
+extern void test_stats();
+extern void test_syscalls();
+extern void test_timer();
 
 int main()
 {
 	test_custom_machine();
 
 	test_crashes();
+	test_faults();
+	test_executor();
+	test_coroutine();
+	test_pool();
+	test_parallel();
+	test_timer();
+	test_stats();
+	test_shared();
+	test_rv32a();
 	test_rv32i();
 	test_rv32c();
+	test_syscalls();
+	test_files();
+	test_native_heap();
+	test_mmap_area();
 	printf("Tests passed!\n");
 	return 0;
 }
@@ -0,0 +1,64 @@
+#if __cplusplus >= 202002L
+#include <libriscv/coroutine.hpp>
+#include <memory>
+using namespace riscv;
+
+// blocks in system call 63, then exits with its result + 1
+static const uint32_t program[] = {
+	0x03f00893, // li   a7, 63
+	0x00000073, // ecall
+	0x00150513, // addi a0, a0, 1
+	0x05d00893, // li   a7, 93
+	0x00000073, // ecall
+};
+
+static CoTask<uint32_t> run_guest(CoMachine<RISCV32>& vm)
+{
+	const int status = co_await vm.run();
+	assert(status == 0);
+	co_return vm.machine().cpu.reg(RISCV::REG_ARG0);
+}
+
+void test_coroutine()
+{
+	static constexpr int MACHINES = 3;
+	std::vector<std::unique_ptr<Machine<RISCV32>>> machines;
+	std::vector<std::unique_ptr<CoMachine<RISCV32>>> vms;
+	std::vector<CoTask<uint32_t>> tasks;
+	for (int i = 0; i < MACHINES; i++)
+	{
+		machines.push_back(std::make_unique<Machine<RISCV32>> (std::vector<uint8_t>{}, 65536));
+		auto& machine = *machines.back();
+		vms.push_back(std::make_unique<CoMachine<RISCV32>> (machine));
+		auto* vm = vms.back().get();
+		machine.copy_to_guest(0x1000, program, sizeof(program));
+		machine.memory.set_page_attr(0x1000, riscv::Page::size(), {
+			 .read = true, .write = false, .exec = true
+		});
+		machine.install_syscall_handler(63,
+		[vm] (Machine<RISCV32>&) -> long {
+			vm->block();
+			return 0;
+		});
+		machine.install_syscall_handler(93,
+		[] (Machine<RISCV32>& machine) -> long {
+			machine.stop();
+			return machine.cpu.reg(RISCV::REG_ARG0);
+		});
+		machine.cpu.jump(0x1000);
+		// every guest is now blocked, and nothing has finished
+		tasks.push_back(run_guest(*vm));
+		assert(vm->blocked());
+		assert(!tasks.back().done());
+	}
+	// complete the host events in reverse order
+	for (int i = MACHINES-1; i >= 0; i--) {
+		vms.at(i)->wake(100 + i);
+		assert(tasks.at(i).done());
+		assert(tasks.at(i).get() == 101u + i);
+		for (int j = 0; j < i; j++) assert(!tasks.at(j).done());
+	}
+}
+#else
+void test_coroutine() {}
+#endif
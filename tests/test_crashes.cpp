@@ -33,11 +33,13 @@ unsigned char crash_983d2079843182f2cb27e6aeeb47af256c44fcdd[] = {
 };
 unsigned int crash_983d2079843182f2cb27e6aeeb47af256c44fcdd_len = 13;
 
-template <int W>
-void execute(riscv::Machine<W> machine, const char* array_name,
+template <int W = riscv::RISCV32>
+void execute(uint32_t memory, const char* array_name,
 			uint8_t* data, size_t len)
 {
 	printf("* Testing %s\n", array_name);
+	// every crash gets a fresh machine
+	riscv::Machine<W> machine { {}, memory };
 	machine.copy_to_guest(0x1000, data, len);
 	// make the instructions readable & executable
 	machine.memory.set_page_attr(0x1000, riscv::Page::size(), {
@@ -57,10 +59,9 @@ void execute(riscv::Machine<W> machine, const char* array_name,
 void test_crashes()
 {
 	const uint32_t memory = 65536;
-	riscv::Machine<riscv::RISCV32> m { {}, memory };
 
 	// test for crashes
-	TEST_CRASH(m, crash_f6999f60cd85cb2a4b567e2e9783c63001de98f0);
-	TEST_CRASH(m, crash_675b93f2255f0ac4ca4ae13f4e9f8122d74baea8);
-	TEST_CRASH(m, crash_983d2079843182f2cb27e6aeeb47af256c44fcdd);
+	TEST_CRASH(memory, crash_f6999f60cd85cb2a4b567e2e9783c63001de98f0);
+	TEST_CRASH(memory, crash_675b93f2255f0ac4ca4ae13f4e9f8122d74baea8);
+	TEST_CRASH(memory, crash_983d2079843182f2cb27e6aeeb47af256c44fcdd);
 }
@@ -0,0 +1,60 @@
+#include <libriscv/executor.hpp>
+#include <cassert>
+#include <memory>
+using namespace riscv;
+
+// counts A0 up to A1, then exits
+static const uint32_t program[] = {
+	0x00150513, // addi a0, a0, 1
+	0xfeb54ee3, // blt  a0, a1, -4
+	0x05d00893, // li   a7, 93
+	0x00000073, // ecall
+};
+
+static std::unique_ptr<Machine<RISCV32>> create_machine(uint32_t count)
+{
+	auto machine = std::make_unique<Machine<RISCV32>> (std::vector<uint8_t>{}, 65536);
+	machine->copy_to_guest(0x1000, program, sizeof(program));
+	machine->memory.set_page_attr(0x1000, riscv::Page::size(), {
+		 .read = true, .write = false, .exec = true
+	});
+	machine->install_syscall_handler(93,
+	[] (Machine<RISCV32>& machine) -> long {
+		machine.stop();
+		return machine.cpu.reg(RISCV::REG_ARG0);
+	});
+	machine->cpu.jump(0x1000);
+	machine->cpu.reg(RISCV::REG_ARG1) = count;
+	return machine;
+}
+
+void test_executor()
+{
+	static constexpr int MACHINES = 16;
+	std::vector<std::unique_ptr<Machine<RISCV32>>> machines;
+	std::vector<std::future<Executor<RISCV32>::Result>> results;
+	{
+		Executor<RISCV32> executor { 4, 1000 };
+		assert(executor.workers() == 4);
+		for (int i = 0; i < MACHINES; i++) {
+			machines.push_back(create_machine(5000 + i * 1000));
+			results.push_back(executor.submit(*machines.back()));
+		}
+		// this one never finishes on its own
+		machines.push_back(create_machine(0x7FFFFFFF));
+		results.push_back(executor.submit(*machines.back(), 20000));
+	}
+	for (int i = 0; i < MACHINES; i++) {
+		const auto result = results.at(i).get();
+		const uint32_t count = 5000 + i * 1000;
+		assert(result.status == 0);
+		assert(!result.timed_out);
+		// two instructions per iteration, plus two to exit
+		assert(result.stats.instructions == 2 * count + 2);
+		assert(result.stats.slices == (result.stats.instructions + 999) / 1000);
+		assert(machines.at(i)->cpu.reg(RISCV::REG_ARG0) == count);
+	}
+	const auto result = results.back().get();
+	assert(result.timed_out);
+	assert(result.stats.instructions == 20000);
+}
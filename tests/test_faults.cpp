@@ -0,0 +1,147 @@
+#include <libriscv/machine.hpp>
+#include <cassert>
+using namespace riscv;
+
+static const uint32_t program[] = {
+	0x01002503, // lw   a0, 16(zero)
+	0x00150513, // addi a0, a0, 1
+};
+
+static void load_program(Machine<RISCV32>& machine)
+{
+	machine.copy_to_guest(0x1000, program, sizeof(program));
+	machine.memory.set_page_attr(0x1000, riscv::Page::size(), {
+		 .read = true, .write = false, .exec = true
+	});
+	machine.cpu.jump(0x1000);
+}
+
+void test_faults()
+{
+	const uint32_t memory = 65536;
+
+	// without a fault handler we get exceptions
+	riscv::Machine<RISCV32> m1 { {}, memory };
+	load_program(m1);
+	bool threw = false;
+	try {
+		m1.simulate(2);
+	} catch (const MachineException& e) {
+		assert(e.type() == PROTECTION_FAULT);
+		threw = true;
+	}
+	assert(threw);
+
+	// a fault handler can stop the machine instead
+	riscv::Machine<RISCV32> m2 { {}, memory };
+	load_program(m2);
+	int faults = 0;
+	m2.cpu.set_fault_handler(
+	[&faults] (CPU<RISCV32>&, int, uint32_t) {
+		faults++;
+		return false;
+	});
+	assert(m2.simulate(2) == -1);
+	assert(faults == 1);
+	assert(m2.stopped());
+	assert(m2.cpu.fault().type == PROTECTION_FAULT);
+	assert(m2.cpu.fault().pc   == 0x1000);
+	assert(m2.cpu.fault().data == 0x10);
+
+	// ... or resolve the fault and continue
+	riscv::Machine<RISCV32> m3 { {}, memory };
+	load_program(m3);
+	m3.cpu.set_fault_handler(
+	[] (CPU<RISCV32>& cpu, int type, uint32_t addr) {
+		if (type != PROTECTION_FAULT) return false;
+		cpu.machine().memory.set_page_attr(addr & ~0xFFF, riscv::Page::size(), {
+			 .read = true, .write = false, .exec = false
+		});
+		return true;
+	});
+	assert(m3.simulate(2) == 0);
+	assert(m3.cpu.reg(RISCV::REG_ARG0) == 1);
+	// the zero after the program is an illegal instruction
+	assert(m3.simulate(1) == -1);
+	assert(m3.cpu.fault().pc == 0x1008);
+	assert(m3.cpu.fault().type != PROTECTION_FAULT);
+
+	// a faulting instruction is abandoned: the load doesn't write a0,
+	// and the pc stays on it, so that it can be resumed later
+	riscv::Machine<RISCV32> m4 { {}, memory };
+	load_program(m4);
+	m4.cpu.reg(RISCV::REG_ARG0) = 0x1234;
+	m4.cpu.set_fault_handler(
+	[] (CPU<RISCV32>&, int, uint32_t) { return false; });
+	assert(m4.simulate(2) == -1);
+	assert(m4.cpu.reg(RISCV::REG_ARG0) == 0x1234);
+	assert(m4.cpu.pc() == m4.cpu.fault().pc && m4.cpu.pc() == 0x1000);
+	assert(m4.cpu.registers().counter == 0);
+	// the reported fault is cleared by the next run, which resumes
+	m4.memory.set_page_attr(0x0, riscv::Page::size(), {
+		 .read = true, .write = true, .exec = false
+	});
+	m4.memory.write<uint32_t> (0x10, 0x4321);
+	assert(m4.simulate(2) == 0);
+	assert(m4.cpu.fault().type < 0);
+	assert(m4.cpu.reg(RISCV::REG_ARG0) == 0x4322);
+
+	// a fault raised by the host before the run is reported by it
+	riscv::Machine<RISCV32> m5 { {}, memory };
+	load_program(m5);
+	m5.cpu.set_fault_handler(
+	[] (CPU<RISCV32>&, int, uint32_t) { return false; });
+	assert(m5.memory.read<uint32_t> (0x10) == 0);
+	assert(m5.cpu.fault().type == PROTECTION_FAULT);
+	assert(m5.simulate(2) == -1);
+	assert(m5.cpu.registers().counter == 0);
+	assert(m5.cpu.fault().type == PROTECTION_FAULT);
+
+	// a misaligned jump doesn't link, nor move the pc
+	static const uint32_t jump[] = {
+		0x002500e7, // jalr ra, 2(a0)
+	};
+	riscv::Machine<RISCV32> m6 { {}, memory };
+	m6.copy_to_guest(0x1000, jump, sizeof(jump));
+	m6.cpu.jump(0x1000);
+	m6.cpu.reg(RISCV::REG_ARG0) = 0x2001;
+	m6.cpu.reg(RISCV::REG_RA) = 0x5555;
+	m6.cpu.set_fault_handler(
+	[] (CPU<RISCV32>&, int, uint32_t) { return false; });
+	assert(m6.simulate(1) == -1);
+	assert(m6.cpu.fault().type == MISALIGNED_INSTRUCTION);
+	assert(m6.cpu.reg(RISCV::REG_RA) == 0x5555);
+	assert(m6.cpu.pc() == 0x1000);
+
+	// untouched pages that can't be accessed are not created, so that
+	// reserving far more than the memory of the machine is possible
+	riscv::Machine<RISCV32> m7 { {}, memory };
+	m7.cpu.set_fault_handler(
+	[] (CPU<RISCV32>&, int, uint32_t) { return false; });
+	const size_t active = m7.memory.pages_active();
+	const uint32_t NONE = 0x100000;
+	m7.memory.set_page_attr(NONE, 256 * memory, { .read = false, .write = false });
+	assert(m7.memory.pages_active() == active);
+	assert(m7.memory.read<uint32_t> (NONE + 0x1000) == 0);
+	assert(m7.cpu.fault().type == PROTECTION_FAULT);
+	m7.memory.write<uint32_t> (NONE + 0x2000, 1);
+	assert(m7.memory.pages_active() == active);
+	std::vector<riscv::MemorySpan<const uint8_t>> in;
+	assert(!m7.memory.gather(NONE, 0x100, in));
+	// ... until the attributes change again
+	m7.memory.set_page_attr(NONE + 0x1000, riscv::Page::size(), {});
+	m7.memory.write<uint32_t> (NONE + 0x1000, 2);
+	assert(m7.memory.read<uint32_t> (NONE + 0x1000) == 2);
+	assert(!m7.memory.get_page_attr(NONE).read);
+	assert(!m7.memory.get_page_attr(NONE + 0x2000).read);
+	// snapshots bring them back, and freeing them leaves zeroes
+	m7.snapshot();
+	m7.memory.set_page_attr(NONE, 2 * riscv::Page::size(), {});
+	assert(m7.memory.get_page_attr(NONE).read);
+	m7.restore_snapshot();
+	assert(!m7.memory.get_page_attr(NONE).read);
+	assert(m7.memory.get_page_attr(NONE + 0x1000).read);
+	m7.memory.free_pages(NONE, 256 * memory);
+	assert(m7.memory.get_page_attr(NONE + 0x2000).read);
+	assert(m7.memory.read<uint32_t> (NONE + 0x1000) == 0);
+}
@@ -0,0 +1,95 @@
+#include <files.hpp>
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static void write_file(const std::string& path, const char* text)
+{
+	const int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	assert(fd >= 0);
+	assert(::write(fd, text, strlen(text)) == (ssize_t) strlen(text));
+	::close(fd);
+}
+
+void test_files()
+{
+	// sandbox/
+	//   a.txt, sub/b.txt, fifo
+	//   up -> ..   (symlinked directory)
+	//   link.txt -> a.txt
+	// secret.txt, outside of the sandbox
+	char temp[] = "/tmp/riscv_files_XXXXXX";
+	assert(mkdtemp(temp) != nullptr);
+	const std::string top = temp;
+	const std::string root = top + "/sandbox";
+	assert(mkdir(root.c_str(), 0755) == 0);
+	assert(mkdir((root + "/sub").c_str(), 0755) == 0);
+	write_file(root + "/a.txt", "a");
+	write_file(root + "/sub/b.txt", "b");
+	write_file(top + "/secret.txt", "secret");
+	assert(mkfifo((root + "/fifo").c_str(), 0644) == 0);
+	assert(symlink("..", (root + "/up").c_str()) == 0);
+	assert(symlink("a.txt", (root + "/link.txt").c_str()) == 0);
+
+	{
+		FileTable files { root };
+		// absolute paths and "." start at the sandbox directory
+		const int a = files.open("/a.txt", O_RDONLY);
+		assert(a == FileTable::FIRST_FD && files.host_fd(a) >= 0);
+		const int b = files.open("./sub//b.txt", O_RDONLY);
+		assert(b == a + 1);
+		char c = 0;
+		assert(::read(files.host_fd(b), &c, 1) == 1 && c == 'b');
+
+		// nothing outside of the sandbox can be reached
+		assert(files.open("../secret.txt", O_RDONLY) == -EACCES);
+		assert(files.open("sub/../../secret.txt", O_RDONLY) == -EACCES);
+		assert(files.open("/../secret.txt", O_RDONLY) == -EACCES);
+		// symlinks are refused, in a directory and in the final component
+		assert(files.open("up/secret.txt", O_RDONLY) < 0);
+		assert(files.open("up/sandbox/a.txt", O_RDONLY) < 0);
+		assert(files.open("link.txt", O_RDONLY) == -EACCES);
+		// only regular files can be opened
+		assert(files.open("fifo", O_RDONLY) == -EACCES);
+		assert(files.open("sub", O_RDONLY) == -EACCES);
+		assert(files.open("/", O_RDONLY) == -EISDIR);
+		assert(files.open("missing.txt", O_RDONLY) == -ENOENT);
+		assert(files.open("a.txt/x", O_RDONLY) == -ENOTDIR);
+		// and only for reading
+		assert(files.open("a.txt", O_WRONLY) == -EACCES);
+		assert(files.open("a.txt", O_RDWR) == -EACCES);
+		assert(files.open("new.txt", O_RDONLY | O_CREAT) == -EACCES);
+		assert(files.open("a.txt", O_RDONLY | O_TRUNC) == -EACCES);
+		assert(access((root + "/new.txt").c_str(), F_OK) != 0);
+
+		// closed fds are reused, lowest first
+		assert(files.close(a) == 0);
+		assert(files.host_fd(a) == -1);
+		assert(files.close(a) == -EBADF);
+		assert(files.close(0) == -EBADF && files.close(1000) == -EBADF);
+		assert(files.open("a.txt", O_RDONLY) == a);
+
+		// at most MAX_FILES are open at once
+		int count = 2;
+		while (count < FileTable::MAX_FILES) {
+			assert(files.open("a.txt", O_RDONLY) == FileTable::FIRST_FD + count);
+			count++;
+		}
+		assert(files.open("a.txt", O_RDONLY) == -EMFILE);
+		assert(files.close(b) == 0);
+		assert(files.open("a.txt", O_RDONLY) == b);
+	}
+
+	unlink((root + "/link.txt").c_str());
+	unlink((root + "/up").c_str());
+	unlink((root + "/fifo").c_str());
+	unlink((root + "/sub/b.txt").c_str());
+	unlink((root + "/a.txt").c_str());
+	rmdir((root + "/sub").c_str());
+	rmdir(root.c_str());
+	unlink((top + "/secret.txt").c_str());
+	rmdir(top.c_str());
+}
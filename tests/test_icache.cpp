@@ -0,0 +1,107 @@
+#include <libriscv/machine.hpp>
+#include <cassert>
+#include <cstdio>
+#include <vector>
+using namespace riscv;
+static_assert(!debugging_enabled, "The instruction cache is not used with RISCV_DEBUG");
+
+// ECALLs with a constant system call number in front of them
+static const uint32_t program[] = {
+	0x06400893, // li   a7, 100
+	0x00000073, // ecall
+	0x05d00893, // li   a7, 93
+	0x00000073, // ecall
+};
+static const uint16_t compressed_program[] = {
+	0x4895,         // c.li a7, 5
+	0x0073, 0x0000, // ecall
+	0x0893, 0x05d0, // li   a7, 93
+	0x0073, 0x0000, // ecall
+};
+static std::vector<int> calls;
+
+static void run(Machine<RISCV32>& machine, uint32_t pc)
+{
+	machine.cpu.jump(pc);
+	machine.simulate(1000);
+	assert(machine.stopped());
+}
+
+static void test_direct_ecall()
+{
+	Machine<RISCV32> machine { std::vector<uint8_t>{}, 65536 };
+	machine.copy_to_guest(0x1000, program, sizeof(program));
+	machine.copy_to_guest(0x1100, compressed_program, sizeof(compressed_program));
+	machine.memory.set_page_attr(0x1000, Page::size(), {
+		 .read = true, .write = false, .exec = true
+	});
+	for (int n : {5, 100, 101}) {
+		machine.install_syscall_handler(n,
+		[n] (Machine<RISCV32>&) -> long {
+			calls.push_back(n);
+			return -n;
+		});
+	}
+	machine.install_syscall_handler(93,
+	[] (Machine<RISCV32>& machine) -> long {
+		machine.stop();
+		return machine.cpu.reg(RISCV::REG_RETVAL);
+	});
+
+	// li a7, N; ecall is decoded into a direct call, which returns
+	// the same as going through system_call()
+	run(machine, 0x1000);
+	const uint32_t direct = machine.cpu.reg(RISCV::REG_RETVAL);
+	machine.cpu.reg(RISCV::REG_ECALL) = 100;
+	machine.system_call(100);
+	assert(direct == uint32_t(-100) && machine.cpu.reg(RISCV::REG_RETVAL) == direct);
+	assert(machine.stats().syscalls_by_number[100] == 2);
+	run(machine, 0x1100);
+	assert(machine.cpu.reg(RISCV::REG_RETVAL) == uint32_t(-5));
+	assert(calls == (std::vector<int>{100, 100, 5}));
+
+	// jumping straight to the cached ECALL with another number in A7
+	calls.clear();
+	machine.cpu.reg(RISCV::REG_ECALL) = 101;
+	run(machine, 0x1004);
+	assert(calls == std::vector<int>{101});
+	assert(machine.cpu.reg(RISCV::REG_RETVAL) == uint32_t(-101));
+
+	// a handler installed after the ECALL was cached is used
+	calls.clear();
+	machine.install_syscall_handler(100,
+	[] (Machine<RISCV32>&) -> long {
+		calls.push_back(1000);
+		return 1000;
+	});
+	run(machine, 0x1000);
+	assert(calls == std::vector<int>{1000});
+	assert(machine.cpu.reg(RISCV::REG_RETVAL) == 1000);
+
+	// and without a handler the ECALL is unhandled, as usual
+	machine.install_syscall_handler(100, nullptr);
+	run(machine, 0x1000);
+	assert(machine.cpu.reg(RISCV::REG_RETVAL) == uint32_t(-ENOSYS));
+	machine.throw_on_unhandled_syscall = true;
+	machine.cpu.jump(0x1000);
+	bool threw = false;
+	try {
+		machine.simulate(1000);
+	} catch (const MachineException& e) {
+		assert(e.type() == UNHANDLED_SYSCALL && e.data() == 100);
+		threw = true;
+	}
+	assert(threw);
+}
+
+// pages don't own their decoder caches, which are never freed
+extern "C" const char* __asan_default_options() { return "detect_leaks=0"; }
+
+// built separately from the other tests, without RISCV_DEBUG,
+// so that the instruction decoder cache is used
+int main()
+{
+	test_direct_ecall();
+	printf("Instruction cache tests passed!\n");
+	return 0;
+}
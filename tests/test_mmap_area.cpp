@@ -0,0 +1,55 @@
+#include <mmap_area.hpp>
+#include <cassert>
+
+void test_mmap_area()
+{
+	static constexpr uint32_t P = MmapArea::PAGE_SIZE;
+	static constexpr uint32_t BEGIN = 0x40000000;
+	static constexpr uint32_t END   = BEGIN + 64 * P;
+	MmapArea area { BEGIN, END };
+	assert(MmapArea::page_align(1) == P && MmapArea::page_align(P) == P);
+	assert(MmapArea::page_align(0) == 0);
+	assert(area.contains(BEGIN, 64 * P) && area.contains(END, 0));
+	assert(!area.contains(BEGIN - P, P) && !area.contains(END - P, 2 * P));
+	assert(!area.contains(END - P, UINT32_MAX));
+
+	// taken from the bottom up
+	const uint32_t a = area.allocate(4 * P);
+	const uint32_t b = area.allocate(P);
+	const uint32_t c = area.allocate(2 * P);
+	assert(a == BEGIN && b == a + 4 * P && c == b + P);
+	assert(area.allocate(64 * P) == 0);
+
+	// fixed ranges have to be free in their entirety
+	assert(!area.allocate_at(c, P));
+	assert(!area.allocate_at(c + 2 * P - P, 2 * P));
+	assert(!area.allocate_at(BEGIN - P, P));
+	assert(!area.allocate_at(END - P, 2 * P));
+	assert(!area.allocate_at(END - P, UINT32_MAX - P));
+	assert(area.allocate_at(END - P, P));
+	assert(!area.allocate_at(END - P, P));
+
+	// a released range is reused by the lowest fit
+	area.release(a, 4 * P);
+	assert(area.allocate(5 * P) == c + 2 * P);
+	assert(area.allocate(3 * P) == a);
+	assert(area.allocate(P) == a + 3 * P);
+
+	// releasing merges with the free ranges on both sides: a and c
+	// are freed, then b joins them into one range of 7 pages
+	area.release(a, 4 * P);
+	area.release(c, 2 * P);
+	assert(area.allocate(7 * P) != a);
+	area.release(b, P);
+	assert(area.allocate(7 * P) == a);
+	area.release(a, 7 * P);
+
+	// ranges that are partly free already are released as a whole
+	area.release(a + P, 2 * P);
+	area.release(BEGIN, 64 * P);
+	assert(area.allocate(64 * P) == BEGIN);
+	area.release(BEGIN, 64 * P);
+	assert(area.allocate_at(BEGIN + 10 * P, 3 * P));
+	area.release(BEGIN + 9 * P, 5 * P);
+	assert(area.allocate(64 * P) == BEGIN);
+}
@@ -0,0 +1,133 @@
+#include <native_heap.hpp>
+#include <cassert>
+#include <utility>
+#include <vector>
+using sas_alloc::Arena;
+
+static constexpr Arena::PointerType BASE = 0x100000;
+static constexpr Arena::PointerType END  = 0x200000;
+
+static void test_size_classes()
+{
+	assert(Arena::size_class(1) == 0 && Arena::size_class(8) == 0);
+	assert(Arena::size_class(9) == 1 && Arena::size_class(128) == 15);
+	assert(Arena::size_class(129) == 16 && Arena::class_size(16) == 160);
+	assert(Arena::size_class(Arena::MAX_SMALL) == Arena::NUM_CLASSES-1);
+	assert(Arena::class_size(Arena::NUM_CLASSES-1) == Arena::MAX_SMALL);
+	for (unsigned cl = 0; cl < Arena::NUM_CLASSES; cl++)
+	{
+		// the largest size in each class is the size of the class
+		const size_t size = Arena::class_size(cl);
+		assert(Arena::size_class(size) == cl);
+		if (cl > 0) {
+			assert(size > Arena::class_size(cl-1));
+			assert(Arena::size_class(Arena::class_size(cl-1) + 1) == cl);
+		}
+	}
+}
+
+static void test_free_ranges()
+{
+	Arena arena { BASE, END };
+	// large allocations are taken from the start of the free range
+	const auto a = arena.malloc(8192);
+	const auto b = arena.malloc(5000);
+	const auto c = arena.malloc(8192);
+	assert(a == BASE && b == a + 8192 && c == b + 8192);
+	assert(arena.size(b) == 8192 && arena.allocations() == 3);
+
+	// b is merged with the free ranges on both sides of it, so that
+	// the whole arena is one range again
+	assert(arena.free(a) == 0);
+	assert(arena.free(c) == 0);
+	assert(arena.malloc(END - BASE) == 0);
+	assert(arena.free(b) == 0);
+	assert(arena.allocations() == 0);
+	const auto all = arena.malloc(END - BASE);
+	assert(all == BASE);
+	assert(arena.malloc(1) == 0);
+
+	// double frees and bogus pointers are refused
+	assert(arena.free(all) == 0);
+	assert(arena.free(all) == -1);
+	assert(arena.free(0) == -1);
+	const auto small = arena.malloc(20);
+	assert(small != 0 && arena.size(small) == 24);
+	assert(arena.free(small + 8) == -1);
+	assert(arena.free(small) == 0);
+	assert(arena.free(small) == -1);
+	// a freed block is reused by its size class
+	assert(arena.malloc(17) == small);
+}
+
+static void test_resize()
+{
+	Arena arena { BASE, END };
+	const auto x = arena.malloc(8192);
+	const auto y = arena.malloc(8192);
+	const auto z = arena.malloc(8192);
+	assert(arena.free(y) == 0);
+
+	// growing into the free range behind it
+	assert(arena.resize(x, 16384) && arena.size(x) == 16384);
+	assert(!arena.resize(x, 16385)); // z is in the way
+	assert(arena.size(x) == 16384);
+	// shrinking gives back a range of its own, between x and z
+	assert(arena.resize(x, 6000) && arena.size(x) == 8192);
+	assert(arena.malloc(8192) == x + 8192);
+	assert(arena.free(x + 8192) == 0);
+
+	// ... which merges with a free range ahead of it
+	assert(arena.free(z) == 0);
+	assert(arena.resize(x, 40000));
+	assert(arena.resize(x, 8192));
+	assert(arena.malloc(END - BASE - 8192) == x + 8192);
+
+	// small allocations only resize within their class
+	assert(arena.free(x + 8192) == 0);
+	const auto s = arena.malloc(20);
+	assert(s != 0);
+	assert(arena.resize(s, 24) && arena.size(s) == 24);
+	assert(!arena.resize(s, 25) && !arena.resize(s, 8192));
+	assert(!arena.resize(x, 100) && !arena.resize(x, 0));
+	assert(!arena.resize(x + 4, 8192));
+}
+
+static void test_release()
+{
+	std::vector<std::pair<Arena::PointerType, size_t>> released;
+	Arena arena { BASE, END,
+		[&] (Arena::PointerType addr, size_t len) {
+			released.push_back({addr, len});
+		} };
+	// the whole arena starts out released
+	assert(released.size() == 1 && released[0].first == BASE);
+	assert(released[0].second == END - BASE);
+	released.clear();
+	assert(arena.zeroed(Arena::MAX_SMALL + 1) && !arena.zeroed(Arena::MAX_SMALL));
+
+	// small allocations keep their memory
+	const auto small = arena.malloc(Arena::MAX_SMALL);
+	assert(arena.free(small) == 0);
+	assert(released.empty());
+
+	// larger ones give back their pages, also when shrinking
+	const auto large = arena.malloc(Arena::MAX_SMALL + 1);
+	assert(arena.size(large) == 8192);
+	assert(arena.resize(large, 20000) && arena.size(large) == 20480);
+	assert(released.empty());
+	assert(arena.resize(large, 12288));
+	assert(released.size() == 1);
+	assert(released[0].first == large + 12288 && released[0].second == 8192);
+	assert(arena.free(large) == 0);
+	assert(released.size() == 2);
+	assert(released[1].first == large && released[1].second == 12288);
+}
+
+void test_native_heap()
+{
+	test_size_classes();
+	test_free_ranges();
+	test_resize();
+	test_release();
+}
@@ -0,0 +1,78 @@
+#include <libriscv/machine.hpp>
+#include <cassert>
+#include <thread>
+using namespace riscv;
+
+// increments the counter at 0x2000 with AMOADD.W and with
+// a LR.W/SC.W loop, A1 times each, then exits
+static const uint32_t program[] = {
+	0x000022b7, // lui  t0, 0x2
+	0x00100313, // li   t1, 1
+	0x0062a02f, // amoadd.w zero, t1, (t0)
+	0x1002a3af, // lr.w t2, (t0)
+	0x00138393, // addi t2, t2, 1
+	0x1872ae2f, // sc.w t3, t2, (t0)
+	0xfe0e1ae3, // bnez t3, -12
+	0x00150513, // addi a0, a0, 1
+	0xfeb544e3, // blt  a0, a1, -24
+	0x05d00893, // li   a7, 93
+	0x00000073, // ecall
+};
+
+void test_parallel()
+{
+	static constexpr int THREADS = 4;
+	static constexpr uint32_t COUNT = 5000;
+	Machine<RISCV32> machine { std::vector<uint8_t>{}, 65536 };
+	machine.copy_to_guest(0x1000, program, sizeof(program));
+	machine.memory.set_page_attr(0x1000, riscv::Page::size(), {
+		 .read = true, .write = false, .exec = true
+	});
+	int exits = 0;
+	machine.install_syscall_handler(93,
+	[&exits] (Machine<RISCV32>& machine) -> long {
+		exits++; // protected by the system call lock
+		machine.stop();
+		return 0;
+	});
+	machine.cpu.jump(0x1000);
+	machine.cpu.reg(RISCV::REG_ARG1) = COUNT;
+
+	std::vector<std::unique_ptr<Machine<RISCV32>>> cpus;
+	for (int i = 1; i < THREADS; i++)
+		cpus.push_back(std::make_unique<Machine<RISCV32>> (shared_memory, machine));
+	assert(machine.memory.is_shared() && machine.syscall_lock() != nullptr);
+	assert(cpus[0]->cpu.pc() == 0x1000);
+
+	std::vector<std::thread> threads;
+	for (auto& cpu : cpus)
+		threads.emplace_back([&cpu] { cpu->simulate(); });
+	machine.simulate();
+	for (auto& thread : threads) thread.join();
+
+	assert(exits == THREADS);
+	// no increments were lost
+	assert(machine.memory.read<uint32_t> (0x2000) == 2 * THREADS * COUNT);
+	// pages created by one machine are seen by all of them, also
+	// by a machine that read the page before it was created
+	assert(machine.memory.read<uint32_t> (0x8000) == 0);
+	cpus[0]->memory.write<uint32_t> (0x8000, 1234);
+	assert(machine.memory.read<uint32_t> (0x8000) == 1234);
+	machine.memory.free_pages(0x8000, Page::size());
+	assert(cpus[0]->memory.read<uint32_t> (0x8000) == 0);
+
+	// a machine created by a handler (like clone) finds the lock
+	// already held, when it was created before the guest ran
+	Machine<RISCV32> parent { std::vector<uint8_t>{}, 65536 };
+	parent.use_syscall_lock();
+	std::unique_ptr<Machine<RISCV32>> child;
+	bool held = false;
+	parent.install_syscall_handler(220,
+	[&] (Machine<RISCV32>& machine) -> long {
+		child = std::make_unique<Machine<RISCV32>> (shared_memory, machine);
+		held = !child->syscall_lock()->try_lock();
+		return 0;
+	});
+	parent.system_call(220);
+	assert(held && child->syscall_lock() == parent.syscall_lock());
+}
@@ -0,0 +1,78 @@
+#include <libriscv/machine_pool.hpp>
+#include <cassert>
+using namespace riscv;
+
+// increments the value at 0x2000, stores a copy at 0x3000, then exits
+static const uint32_t program[] = {
+	0x000022b7, // lui  t0, 0x2
+	0x0002a503, // lw   a0, 0(t0)
+	0x00150513, // addi a0, a0, 1
+	0x00a2a023, // sw   a0, 0(t0)
+	0x00003337, // lui  t1, 0x3
+	0x00a32023, // sw   a0, 0(t1)
+	0x05d00893, // li   a7, 93
+	0x00000073, // ecall
+};
+
+static void setup_machine(Machine<RISCV32>& machine)
+{
+	machine.copy_to_guest(0x1000, program, sizeof(program));
+	machine.memory.set_page_attr(0x1000, riscv::Page::size(), {
+		 .read = true, .write = false, .exec = true
+	});
+	machine.memory.write<uint32_t> (0x2000, 41);
+	machine.install_syscall_handler(93,
+	[] (Machine<RISCV32>& machine) -> long {
+		machine.stop();
+		return machine.cpu.reg(RISCV::REG_ARG0);
+	});
+	machine.cpu.jump(0x1000);
+}
+
+void test_pool()
+{
+	// restoring a snapshot only touches the changed pages
+	{
+		Machine<RISCV32> machine { std::vector<uint8_t>{}, 65536 };
+		setup_machine(machine);
+		machine.snapshot();
+		const size_t pages = machine.memory.pages_active();
+		assert(machine.memory.pages_dirty() == 0);
+		for (int i = 0; i < 3; i++) {
+			machine.simulate();
+			assert(machine.cpu.reg(RISCV::REG_ARG0) == 42);
+			assert(machine.memory.pages_active() == pages + 1);
+			// 0x2000 was changed, and 0x3000 was created
+			assert(machine.restore_snapshot() == 2);
+			assert(machine.memory.pages_active() == pages);
+			assert(machine.memory.read<uint32_t> (0x2000) == 41);
+			assert(machine.memory.read<uint32_t> (0x3000) == 0);
+			assert(machine.cpu.pc() == 0x1000);
+			assert(machine.cpu.instruction_counter() == 0);
+		}
+	}
+
+	int resets = 0;
+	MachinePool<RISCV32> pool { {}, 65536, setup_machine,
+		[&resets] (Machine<RISCV32>&) { resets++; }, 2 };
+	pool.prewarm(1);
+	assert(pool.idle() == 1 && pool.created() == 1);
+	for (int i = 0; i < 3; i++) {
+		auto machine = pool.acquire();
+		assert(pool.idle() == 0);
+		machine->simulate();
+		assert(machine->cpu.reg(RISCV::REG_ARG0) == 42);
+	}
+	// the same machine was recycled every time
+	assert(pool.created() == 1 && resets == 3);
+	{
+		auto m1 = pool.acquire();
+		auto m2 = pool.acquire();
+		auto m3 = pool.acquire();
+		assert(pool.created() == 3);
+		m1->simulate();
+		assert(m1->cpu.reg(RISCV::REG_ARG0) == 42);
+	}
+	// no more than two machines are kept
+	assert(pool.idle() == 2);
+}
@@ -0,0 +1,76 @@
+#include <libriscv/machine.hpp>
+#include <cassert>
+using namespace riscv;
+
+#define assert_mem(m, type, addr, value) \
+		assert(m.memory.template read<type> (addr) == value)
+
+static const std::vector<uint32_t> instructions =
+{
+	0x20b2a52f, // amoxor.w  a0, a1, (t0)
+	0x60b2a52f, // amoand.w  a0, a1, (t0)
+	0x80b2a52f, // amomin.w  a0, a1, (t0)
+	0xe0b2a52f, // amomaxu.w a0, a1, (t0)
+	0x1002a52f, // lr.w      a0, (t0)
+	0x1003252f, // lr.w      a0, (t1)
+	0x18b2a62f, // sc.w      a2, a1, (t0)
+	0x1002a52f, // lr.w      a0, (t0)
+	0x18b2a62f, // sc.w      a2, a1, (t0)
+	0x18b2a62f, // sc.w      a2, a1, (t0)
+	0x20b2a52f, // amoxor.w  a0, a1, (t0)
+};
+
+void test_rv32a()
+{
+	const uint32_t memory = 65536;
+	riscv::Machine<riscv::RISCV32> m { {}, memory };
+	const size_t bytes = sizeof(instructions[0]) * instructions.size();
+	m.copy_to_guest(0x1000, instructions.data(), bytes);
+	m.memory.set_page_attr(0x1000, bytes, {
+		 .read = true, .write = false, .exec = true
+	});
+	m.cpu.jump(0x1000);
+	m.cpu.reg(5) = 0x2000; // t0
+	m.cpu.reg(6) = 0x3000; // t1
+	m.memory.write<uint32_t> (0x2000, 0xF0F0);
+
+	// AMOs place the old value in rd
+	m.cpu.reg(RISCV::REG_ARG1) = 0xFF;
+	m.simulate(1);
+	assert(m.cpu.reg(RISCV::REG_ARG0) == 0xF0F0);
+	assert_mem(m, uint32_t, 0x2000, 0xF00F);
+	m.cpu.reg(RISCV::REG_ARG1) = 0xFF00;
+	m.simulate(1);
+	assert(m.cpu.reg(RISCV::REG_ARG0) == 0xF00F);
+	assert_mem(m, uint32_t, 0x2000, 0xF000);
+	// signed and unsigned comparisons
+	m.cpu.reg(RISCV::REG_ARG1) = -5;
+	m.simulate(1);
+	assert_mem(m, uint32_t, 0x2000, (uint32_t) -5);
+	m.cpu.reg(RISCV::REG_ARG1) = 7;
+	m.simulate(1);
+	assert(m.cpu.reg(RISCV::REG_ARG0) == (uint32_t) -5);
+	assert_mem(m, uint32_t, 0x2000, (uint32_t) -5);
+
+	// a new LR replaces the reservation, so the SC fails
+	m.simulate(2);
+	m.cpu.reg(RISCV::REG_ARG1) = 42;
+	m.simulate(1);
+	assert(m.cpu.reg(RISCV::REG_ARG2) != 0);
+	assert_mem(m, uint32_t, 0x2000, (uint32_t) -5);
+	// LR then SC succeeds, and uses up the reservation
+	m.simulate(2);
+	assert(m.cpu.reg(RISCV::REG_ARG2) == 0);
+	assert_mem(m, uint32_t, 0x2000, 42);
+	m.simulate(1);
+	assert(m.cpu.reg(RISCV::REG_ARG2) != 0);
+
+	// misaligned AMOs are not allowed
+	m.cpu.reg(5) = 0x2002;
+	try {
+		m.simulate(1);
+		assert(0 && "Misaligned AMO did not throw");
+	} catch (const MachineException& e) {
+		assert(e.type() == INVALID_ALIGNMENT);
+	}
+}
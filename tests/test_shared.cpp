@@ -0,0 +1,125 @@
+#include <libriscv/machine.hpp>
+#include <cassert>
+using namespace riscv;
+
+// stores 42 at 0x70000000, then exits
+static const uint32_t program[] = {
+	0x70000337, // lui  t1, 0x70000
+	0x02a00513, // li   a0, 42
+	0x00a32023, // sw   a0, 0(t1)
+	0x05d00893, // li   a7, 93
+	0x00000073, // ecall
+};
+static const uint32_t SHARED = 0x70000000;
+
+void test_shared()
+{
+	auto region = std::make_shared<SharedRegion>(3 * Page::size() - 100);
+	assert(region->pages() == 3 && region->size() == 3 * Page::size());
+
+	Machine<RISCV32> producer { std::vector<uint8_t>{}, 65536 };
+	Machine<RISCV32> consumer { std::vector<uint8_t>{}, 65536 };
+	producer.memory.map_shared(SHARED, region, { .read = true, .write = true });
+	consumer.memory.map_shared(SHARED, region, { .read = true, .write = false });
+
+	// a guest store is seen by the other guest and by the host
+	producer.copy_to_guest(0x1000, program, sizeof(program));
+	producer.memory.set_page_attr(0x1000, Page::size(), {
+		 .read = true, .write = false, .exec = true
+	});
+	producer.install_syscall_handler(93,
+	[] (Machine<RISCV32>& machine) -> long {
+		machine.stop();
+		return 0;
+	});
+	producer.cpu.jump(0x1000);
+	producer.simulate();
+	assert(consumer.memory.read<uint32_t>(SHARED) == 42);
+	uint32_t value = 0;
+	region->memcpy_out(&value, 0, sizeof(value));
+	assert(value == 42);
+
+	// the host can write across pages, and the guests see it all
+	const std::string text(5000, 'x');
+	region->memcpy(4000, text.data(), text.size());
+	assert(consumer.memory.memstring(SHARED + 4000, 8192) == text);
+	assert(producer.memory.read<uint8_t>(SHARED + 8999) == 'x');
+	assert(producer.memory.pages_active() == consumer.memory.pages_active() + 1);
+
+	// the read-only mapping can't be written to
+	bool threw = false;
+	try {
+		consumer.memory.write<uint32_t>(SHARED, 0);
+	} catch (const MachineException& e) {
+		assert(e.type() == PROTECTION_FAULT);
+		threw = true;
+	}
+	assert(threw && producer.memory.read<uint32_t>(SHARED) == 42);
+	// and mapping attributes can't be changed from inside
+	consumer.memory.set_page_attr(SHARED, Page::size(), { .read = false });
+	assert(producer.memory.read<uint32_t>(SHARED) == 42);
+	assert(consumer.memory.get_page_attr(SHARED).read);
+	assert(!consumer.memory.get_page_attr(SHARED + 2 * Page::size()).write);
+	assert(producer.memory.get_page_attr(SHARED).write);
+	// host writes through the read-only mapping go nowhere, and are
+	// not seen through the mapping of any other machine
+	Machine<RISCV32> other { std::vector<uint8_t>{}, 65536 };
+	other.memory.map_shared(SHARED, region, { .read = false, .write = false });
+	consumer.memory.memcpy(SHARED + 16, "secret", 7);
+	assert(producer.memory.read<uint8_t>(SHARED + 16) == 0);
+	auto& hidden = other.memory.get_page(SHARED);
+	assert(!hidden.attr.read && hidden.data()[16] == 0);
+	assert(&hidden != &consumer.memory.create_page(SHARED >> Page::SHIFT));
+	assert(other.memory.memstring(SHARED + 16).empty());
+
+	// restoring a snapshot does not touch the region
+	producer.snapshot();
+	producer.memory.write<uint32_t>(SHARED + 8, 7);
+	producer.restore_snapshot();
+	assert(consumer.memory.read<uint32_t>(SHARED + 8) == 7);
+
+	// regions can't overlap, and unmapping leaves zeroes behind
+	threw = false;
+	try {
+		producer.memory.map_shared(SHARED + Page::size(), region, {});
+	} catch (const MachineException& e) {
+		assert(e.type() == ILLEGAL_OPERATION);
+		threw = true;
+	}
+	assert(threw);
+	assert(consumer.memory.unmap_shared(SHARED));
+	assert(!consumer.memory.unmap_shared(SHARED));
+	assert(consumer.memory.read<uint32_t>(SHARED) == 0);
+	assert(producer.memory.read<uint32_t>(SHARED) == 42);
+
+	// a region hides the pages that were touched below it, also when
+	// they are kept in a shared page table, or come back from a snapshot
+	Machine<RISCV32> first { std::vector<uint8_t>{}, 65536 };
+	Machine<RISCV32> second { shared_memory, first };
+	first.memory.write<uint32_t>(SHARED, 1);
+	assert(second.memory.read<uint32_t>(SHARED) == 1);
+	first.memory.map_shared(SHARED, region, {});
+	assert(first.memory.read<uint32_t>(SHARED) == 42);
+	first.memory.write<uint32_t>(SHARED + 4, 5);
+	assert(region->page(0).aligned_read<uint32_t>(4) == 5);
+
+	Machine<RISCV32> restored { std::vector<uint8_t>{}, 65536 };
+	restored.memory.write<uint32_t>(SHARED, 1);
+	restored.snapshot();
+	restored.memory.map_shared(SHARED, region, {});
+	restored.restore_snapshot();
+	assert(restored.memory.read<uint32_t>(SHARED) == 42);
+
+	if constexpr (memory_traps_enabled)
+	{
+		size_t stored = 0;
+		region->set_write_trap(
+		[&stored] (SharedRegion&, size_t offset, size_t size) {
+			assert(offset == 12 && size == 2);
+			stored++;
+		});
+		producer.memory.write<uint16_t>(SHARED + 12, 0x1234);
+		assert(stored == 1 && producer.memory.read<uint16_t>(SHARED + 12) == 0x1234);
+		region->set_write_trap(nullptr);
+	}
+}
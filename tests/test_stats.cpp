@@ -0,0 +1,68 @@
+#include <libriscv/machine.hpp>
+#include <cassert>
+#include <cstring>
+using namespace riscv;
+
+// makes system call 63 twice, stores to 0x3000, then exits
+static const uint32_t program[] = {
+	0x03f00893, // li   a7, 63
+	0x00000073, // ecall
+	0x00000073, // ecall
+	0x00003337, // lui  t1, 0x3
+	0x00a32023, // sw   a0, 0(t1)
+	0x05d00893, // li   a7, 93
+	0x00000073, // ecall
+};
+
+void test_stats()
+{
+	Machine<RISCV32> machine { std::vector<uint8_t>{}, 65536 };
+	machine.copy_to_guest(0x1000, program, sizeof(program));
+	machine.memory.set_page_attr(0x1000, Page::size(), {
+		 .read = true, .write = false, .exec = true
+	});
+	machine.install_syscall_handler(63,
+	[] (Machine<RISCV32>&) -> long {
+		return 0;
+	});
+	machine.install_syscall_handler(93,
+	[] (Machine<RISCV32>& machine) -> long {
+		machine.stop();
+		return 0;
+	});
+	machine.cpu.jump(0x1000);
+	machine.snapshot();
+	const auto before = machine.stats();
+
+	machine.simulate();
+	auto stats = machine.stats();
+	assert(stats.instructions == 7);
+	assert(stats.syscalls == 3);
+	assert(stats.syscalls_by_number[63] == 2 && stats.syscalls_by_number[93] == 1);
+	assert(stats.pages_allocated == before.pages_allocated + 1);
+	assert(stats.pages_peak >= stats.pages_active);
+	assert(stats.snapshots == 1 && stats.restores == 0);
+	assert(stats.simulate_time.count() > 0);
+
+	// the instructions before a restore are still counted
+	machine.restore_snapshot();
+	machine.simulate();
+	stats = machine.stats();
+	assert(stats.instructions == 14 && stats.restores == 1);
+	assert(stats.syscalls == 6);
+	assert(stats.pages_freed == 1);
+
+	// faults are counted, also when a fault handler deals with them
+	// (the zero page at 0x8000 is an illegal instruction, which is
+	// abandoned, and so not counted as an instruction)
+	machine.cpu.set_fault_handler(
+	[] (CPU<RISCV32>&, int, uint32_t) { return false; });
+	machine.cpu.jump(0x8000);
+	assert(machine.simulate() < 0);
+	assert(machine.stats().faults == 1);
+
+	const auto json = machine.stats().to_json();
+	assert(json.front() == '{' && json.back() == '}');
+	assert(strstr(json.c_str(), "\"syscalls_by_number\":{\"63\":4,\"93\":2}") != nullptr);
+	assert(strstr(json.c_str(), "\"instructions\":14,") != nullptr);
+}
@@ -0,0 +1,182 @@
+#include <libriscv/machine.hpp>
+#include <libriscv/syscall_ring.hpp>
+#include <cassert>
+#include <cstring>
+using namespace riscv;
+
+struct timespec32 {
+	int32_t tv_sec;
+	int32_t tv_nsec;
+};
+
+void test_syscalls()
+{
+	const uint32_t memory = 65536;
+	riscv::Machine<RISCV32> m { {}, memory };
+
+	// spans are written straight into guest memory
+	m.install_syscall<100>(
+	[] (Machine<RISCV32>&, int fd, GuestSpan<char> buffer) -> long {
+		assert(fd == 5);
+		std::memcpy(buffer.data(), "hello", buffer.size());
+		return buffer.size();
+	});
+	m.cpu.reg(RISCV::REG_ARG0) = 5;
+	m.cpu.reg(RISCV::REG_ARG1) = 0x2000;
+	m.cpu.reg(RISCV::REG_ARG2) = 5;
+	m.system_call(100);
+	assert(m.cpu.reg(RISCV::REG_RETVAL) == 5);
+	assert(m.memory.memstring(0x2000) == "hello");
+
+	// ... and copied back when they cross a page boundary
+	m.cpu.reg(RISCV::REG_ARG0) = 5;
+	m.cpu.reg(RISCV::REG_ARG1) = 0x2FFE;
+	m.cpu.reg(RISCV::REG_ARG2) = 5;
+	m.system_call(100);
+	assert(m.cpu.reg(RISCV::REG_RETVAL) == 5);
+	assert(m.memory.memstring(0x2FFE) == "hello");
+
+	// the zero-page is not accessible
+	m.cpu.reg(RISCV::REG_ARG0) = 5;
+	m.cpu.reg(RISCV::REG_ARG1) = 0x10;
+	m.cpu.reg(RISCV::REG_ARG2) = 5;
+	m.system_call(100);
+	assert((int) m.cpu.reg(RISCV::REG_RETVAL) == -EFAULT);
+
+	// pointers to objects, strings and void handlers
+	bool called = false;
+	m.install_syscall<101>(
+	[&called] (Machine<RISCV32>&, const timespec32* ts, std::string str) {
+		assert(ts != nullptr && ts->tv_sec == 1 && ts->tv_nsec == 2);
+		assert(str == "hello");
+		called = true;
+	});
+	const timespec32 ts { 1, 2 };
+	m.copy_to_guest(0x3000, &ts, sizeof(ts));
+	m.cpu.reg(RISCV::REG_ARG0) = 0x3000;
+	m.cpu.reg(RISCV::REG_ARG1) = 0x2000;
+	m.system_call(101);
+	assert(called);
+	assert(m.cpu.reg(RISCV::REG_RETVAL) == 0);
+
+	// a frozen table shared between machines, with userdata
+	SyscallTable<RISCV32> table;
+	table.install_syscall<102>(
+	[] (Machine<RISCV32>& machine, int value) -> long {
+		return *machine.get_userdata<int>() + value;
+	});
+	table.freeze();
+	bool threw = false;
+	try {
+		table.install_syscall_handler(103, nullptr);
+	} catch (const MachineException&) {
+		threw = true;
+	}
+	assert(threw);
+
+	riscv::Machine<RISCV32> m1 { {}, memory };
+	riscv::Machine<RISCV32> m2 { {}, memory };
+	int data1 = 1, data2 = 2;
+	m1.attach_syscall_table(&table);
+	m1.set_userdata(&data1);
+	m2.attach_syscall_table(&table);
+	m2.set_userdata(&data2);
+	m1.cpu.reg(RISCV::REG_ARG0) = 10;
+	m1.system_call(102);
+	assert(m1.cpu.reg(RISCV::REG_RETVAL) == 11);
+	m2.cpu.reg(RISCV::REG_ARG0) = 10;
+	m2.system_call(102);
+	assert(m2.cpu.reg(RISCV::REG_RETVAL) == 12);
+
+	// overriding a handler only affects that one machine
+	m2.install_syscall_handler(102,
+	[] (Machine<RISCV32>&) -> long { return 42; });
+	m1.cpu.reg(RISCV::REG_ARG0) = 10;
+	m1.system_call(102);
+	assert(m1.cpu.reg(RISCV::REG_RETVAL) == 11);
+	m2.system_call(102);
+	assert(m2.cpu.reg(RISCV::REG_RETVAL) == 42);
+	assert(&m1.syscall_table() == &table);
+	assert(&m2.syscall_table() != &table);
+
+	// many system calls through a ring with a single call
+	using ring_t = SyscallRing<RISCV32>;
+	riscv::Machine<RISCV32> m3 { {}, memory };
+	m3.install_syscall<110>(
+	[] (Machine<RISCV32>&, int a, int b) -> long {
+		return a + b;
+	});
+	ring_t::Header hdr {};
+	hdr.entries = 4;
+	hdr.sq_addr = 0x4100;
+	hdr.cq_addr = 0x4400;
+	auto submit = [&] (uint32_t i) {
+		const uint32_t sysno = (i == 5 || i == 6) ? 111 : 110;
+		const ring_t::Submission sqe { sysno, 1000 + i, { i, 10 } };
+		m3.copy_to_guest(hdr.sq_addr + (i % 4) * sizeof(sqe), &sqe, sizeof(sqe));
+	};
+	for (uint32_t i = 0; i < 4; i++) submit(i);
+	hdr.sq_tail = 6; // deliberately more than fits
+	m3.copy_to_guest(0x4000, &hdr, sizeof(hdr));
+	assert((ring_t{m3, 0x4000}.process() == -EINVAL));
+
+	hdr.sq_tail = 4;
+	m3.copy_to_guest(0x4000, &hdr, sizeof(hdr));
+	m3.cpu.reg(RISCV::REG_ARG0) = 0x1234;
+	ring_t ring { m3, 0x4000 };
+	assert(ring_t::validate(m3, 0x4000) == 0);
+	assert(ring.pending());
+	assert(ring.process() == 4);
+	assert(!ring.pending());
+	assert(m3.cpu.reg(RISCV::REG_ARG0) == 0x1234);
+	// the completion queue is full now
+	m3.memory.write<uint32_t> (0x4000 + offsetof(ring_t::Header, sq_tail), 6);
+	assert(ring.process() == 0);
+	for (uint32_t i = 0; i < 4; i++) {
+		const auto cqe = m3.memory.read<uint32_t> (hdr.cq_addr + i * 8);
+		const auto res = m3.memory.read<uint32_t> (hdr.cq_addr + i * 8 + 4);
+		assert(cqe == 1000 + i && res == i + 10);
+	}
+	// make room and handle the rest, including a missing system call
+	submit(4);
+	submit(5);
+	m3.memory.write<uint32_t> (0x4000 + offsetof(ring_t::Header, cq_head), 4);
+	assert(ring.process() == 2);
+	assert(m3.memory.read<uint32_t> (hdr.cq_addr + 0 * 8) == 1004);
+	assert(m3.memory.read<uint32_t> (hdr.cq_addr + 1 * 8) == 1005);
+	assert((int) m3.memory.read<uint32_t> (hdr.cq_addr + 1 * 8 + 4) == -ENOSYS);
+	// they are counted like any other system call
+	assert(m3.stats().syscalls_by_number[110] == 5);
+	assert(m3.stats().syscalls_by_number[111] == 1);
+
+	// a handler that throws leaves the registers as they were
+	m3.install_syscall_handler(111,
+	[] (Machine<RISCV32>&) -> long { throw std::runtime_error("oops"); });
+	submit(6);
+	submit(7);
+	m3.memory.write<uint32_t> (0x4000 + offsetof(ring_t::Header, sq_tail), 8);
+	m3.memory.write<uint32_t> (0x4000 + offsetof(ring_t::Header, cq_head), 6);
+	m3.cpu.reg(RISCV::REG_ECALL) = 0x5678;
+	threw = false;
+	try {
+		ring.process();
+	} catch (const std::runtime_error&) {
+		threw = true;
+	}
+	assert(threw);
+	assert(m3.cpu.reg(RISCV::REG_ARG0) == 0x1234);
+	assert(m3.cpu.reg(RISCV::REG_ECALL) == 0x5678);
+	// the submission is consumed, without a completion
+	assert(m3.memory.read<uint32_t> (0x4000 + offsetof(ring_t::Header, sq_head)) == 7);
+	assert(m3.memory.read<uint32_t> (0x4000 + offsetof(ring_t::Header, cq_tail)) == 6);
+
+	// from a system call, on machines that take turns handling them
+	Machine<RISCV32> m4 { shared_memory, m3 };
+	m4.install_syscall_handler(503,
+	[] (Machine<RISCV32>& machine) -> long {
+		return ring_t{machine, 0x4000}.process();
+	});
+	m4.system_call(503);
+	assert(m4.cpu.reg(RISCV::REG_RETVAL) == 1);
+	assert(m4.stats().syscalls_by_number[110] == 1);
+}
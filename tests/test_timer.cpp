@@ -0,0 +1,44 @@
+#include <libriscv/machine.hpp>
+#include <cassert>
+using namespace riscv;
+
+static const uint32_t program[] = {
+	0x00150513, // addi a0, a0, 1
+	0xffdff06f, // j    -4
+};
+
+void test_timer()
+{
+	Machine<RISCV32> machine { std::vector<uint8_t>{}, 65536 };
+	machine.copy_to_guest(0x1000, program, sizeof(program));
+	machine.memory.set_page_attr(0x1000, Page::size(), {
+		 .read = true, .write = false, .exec = true
+	});
+	machine.cpu.jump(0x1000);
+
+	int calls = 0;
+	uint64_t last = 0;
+	machine.set_timer(1000,
+	[&calls, &last] (Machine<RISCV32>& machine) {
+		last = machine.cpu.instruction_counter();
+		if (++calls == 5) machine.stop();
+	});
+	// the timer works without an instruction limit
+	machine.simulate();
+	assert(calls == 5 && last == 5000);
+
+	// and together with one
+	machine.simulate(2500);
+	assert(calls == 7 && machine.cpu.instruction_counter() == 7500);
+
+	// a reset starts a new interval
+	machine.reset_timer();
+	machine.simulate(999);
+	assert(calls == 7);
+	machine.simulate(1);
+	assert(calls == 8 && last == 8500);
+
+	machine.set_timer(0, nullptr);
+	machine.simulate(10000);
+	assert(calls == 8 && machine.cpu.reg(RISCV::REG_ARG0) == 9250);
+}
@@ -19,6 +19,25 @@ static const std::vector<std::string> env = {
 extern uint64_t micros_now();
 extern uint64_t monotonic_micros_now();
 
+// built once, shared by every machine
+static const riscv::SyscallTable<4>& linux_syscalls()
+{
+	static const riscv::SyscallTable<4> table = [] {
+		riscv::SyscallTable<4> table;
+		setup_linux_syscalls(table);
+		setup_multithreading(table);
+		// run the machine until potential break
+		table.install_syscall_handler(0,
+		[] (auto& machine) -> long {
+			machine.stop();
+			return 0;
+		});
+		table.freeze();
+		return table;
+	}();
+	return table;
+}
+
 static void
 protected_execute(const Request& req, Response& res, const ContentReader& creader)
 {
@@ -35,21 +54,11 @@ protected_execute(const Request& req, Response& res, const ContentReader& creade
 
 	State<4> state;
 	// go-time: create machine, execute code
-	riscv::verbose_machine = false;
 	riscv::Machine<riscv::RISCV32> machine { binary, MAX_MEMORY };
 
 	prepare_linux<riscv::RISCV32>(machine, {"program"}, env);
-	setup_linux_syscalls(state, machine);
-	setup_multithreading(state, machine);
-
-	// run the machine until potential break
-	bool break_used = false;
-	machine.install_syscall_handler(0,
-	[&break_used] (auto& machine) -> long {
-		break_used = true;
-		machine.stop();
-		return 0;
-	});
+	machine.attach_syscall_table(&linux_syscalls());
+	attach_multithreading(state, machine);
 
 	// execute until we are inside main()
 	uint32_t main_address = 0x0;
@@ -91,15 +100,16 @@ protected_execute(const Request& req, Response& res, const ContentReader& creade
 	{
 		// reset PC here for benchmarking
 		machine.cpu.reset_instruction_counter();
-		// take a snapshot of the machine
-		std::vector<uint8_t> program_state;
-		machine.serialize_to(program_state);
+		// take a snapshot of the machine, so that each sample
+		// only has to restore the pages the previous one changed
+		machine.snapshot();
+		const State<4> initial_state = state;
 		std::deque<uint64_t> samples;
 		// begin benchmarking 1 + N samples
 		for (int i = 0; i < 1 + BENCH_SAMPLES; i++)
 		{
-			machine.deserialize_from(program_state);
-			state.output.clear();
+			machine.restore_snapshot();
+			state = initial_state;
 			const uint64_t t0 = micros_now();
 			asm("" : : : "memory");
 
@@ -135,15 +145,18 @@ protected_execute(const Request& req, Response& res, const ContentReader& creade
 			res.set_header("X-Runtime-Median", std::to_string(median));
 			res.set_header("X-Runtime-Highest", std::to_string(highest));
 		}
+		const auto stats = machine.stats();
 		const auto instructions = std::to_string(machine.cpu.instruction_counter());
 		res.set_header("X-Instruction-Count", instructions);
 		res.set_header("X-Binary-Size", std::to_string(binary.size()));
-		const size_t active_mem = machine.memory.pages_active() * 4096;
+		const size_t active_mem = stats.pages_active * 4096;
 		res.set_header("X-Memory-Usage", std::to_string(active_mem));
-		const size_t highest_mem = machine.memory.pages_highest_active() * 4096;
+		const size_t highest_mem = stats.pages_peak * 4096;
 		res.set_header("X-Memory-Highest", std::to_string(highest_mem));
 		const size_t max_mem = machine.memory.pages_total() * 4096;
-		res.set_header("X-Memory-Max", std::to_string(highest_mem));
+		res.set_header("X-Memory-Max", std::to_string(max_mem));
+		// everything used by the request, all samples included
+		res.set_header("X-Machine-Stats", stats.to_json());
 		res.set_content(state.output, "text/plain");
 	}
 	else {